@@ -1,6 +1,7 @@
 #include "FileReader.hpp"
 
-#include <fstream>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 
 // trim \r, \n in end of the line
@@ -8,28 +9,245 @@ inline void trim_end(string &s){
 	while(!s.empty() && isspace(s.back())) s.pop_back();
 }
 
+inline void trim_end(string_view &s){
+	while(!s.empty() && isspace(s.back())) s.remove_suffix(1);
+}
+
 // read sequences from file_name
 bool FileReader::read(const string file_name, vector<string> &seq, vector<string> &seq_name){
-	ifstream ifs(file_name);
+	if(!open(file_name)) return false;
+
+	string name, s;
+	while(next(name, s)){
+		seq_name.push_back(name);
+		seq.push_back(s);
+	}
+	return true;
+}
+
+
+// open file_name for next()
+bool FileReader::open(const string &file_name, int decompress_threads){
+	file.close();
+	pos = 0;
+	if(ifs.is_open()) ifs.close();
+	ifs.clear();
+	gz.close();
+	gz_stream.clear();
+	in = nullptr;
+	has_header = false;
+	this->file_name = file_name;
+	index = FastaIndex();
+	indexed = false;
+	next_record = 0;
+	selected.clear();
+	has_selection = false;
+	n_passed = 0;
+	shard_first = 0;
+	shard_last = SIZE_MAX;
+	shard_stride = 1;
+
+	if(GzipStreamBuf::is_gzip(file_name)){
+		if(!gz.open(file_name, decompress_threads)){
+			cout << "Error: cannot open compressed input file (is LinCapR built with zlib?): " << file_name << endl;
+			return false;
+		}
+		gz_stream.rdbuf(&gz);
+		in = &gz_stream;
+		return true;
+	}
+
+	if(file.open(file_name)) return true;
+
+	ifs.open(file_name);
 	if(!ifs){
 		cout << "Error: cannot open input file: " << file_name << endl;
 		return false;
 	}
+	in = &ifs;
+	return true;
+}
+
+
+// returns whether the input ended early (truncated / corrupt compressed input)
+bool FileReader::failed() const{
+	return gz.failed();
+}
+
+
+// read the next record; returns false at end of file
+bool FileReader::next(string &seq_name, string &seq){
+	string_view name_view, seq_view;
+	if(!next(name_view, seq_view)) return false;
+	seq_name.assign(name_view);
+	seq.assign(seq_view);
+	return true;
+}
+
+
+// index the mapped file on threads
+bool FileReader::build_index(int threads){
+	if(!file.is_open()) return false;
+	index.build(file, threads);
+	indexed = true;
+	next_record = 0;
+	n_passed = 0;
+	return true;
+}
+
+
+// load <input>.fai, or index and write it
+bool FileReader::use_fai(int threads){
+	if(!file.is_open()) return false;
+
+	const string fai_file = file_name + ".fai";
+	error_code ec;
+	const auto fai_time = filesystem::last_write_time(fai_file, ec);
+	if(!ec && fai_time >= filesystem::last_write_time(file_name, ec) && !ec && index.load_fai(file, fai_file)){
+		indexed = true;
+		next_record = 0;
+		n_passed = 0;
+		return true;
+	}
+
+	build_index(threads);
+	if(!index.write_fai(file, fai_file)){
+		cout << "Warning: cannot write " << fai_file << " (unwritable, or irregular line lengths)" << endl;
+	}
+	return true;
+}
+
 
-	string line;
-	while(getline(ifs, line)){
-		trim_end(line);
-		if(line.empty()) continue;
-		if(line[0] == '>'){
-			// new sequence
-			seq_name.push_back(line.substr(1));
-			seq.push_back("");
-		}else{
-			// append sequence
-			seq.back() += line;
+void FileReader::select(vector<size_t> ids){
+	selected = move(ids);
+	has_selection = true;
+	next_record = 0;
+	n_passed = 0;
+}
+
+
+void FileReader::set_shard(const size_t k, const size_t n){
+	shard_first = k;
+	shard_last = SIZE_MAX;
+	shard_stride = n;
+}
+
+
+// record j goes to the shard that holds the middle of its bases, so shards are
+// contiguous and get about the same number of bases
+bool FileReader::set_shard_by_length(const size_t k, const size_t n){
+	if(!indexed) return false;
+
+	const size_t n_records = (has_selection ? selected.size() : index.size());
+	auto length = [&](const size_t j){ return index[has_selection ? selected[j] : j].length; };
+	double total = 0;
+	for(size_t j = 0; j < n_records; j++) total += length(j);
+
+	shard_first = shard_last = n_records;
+	shard_stride = 1;
+	double bases = 0;
+	for(size_t j = 0; j < n_records; j++){
+		const size_t shard = min<size_t>(n - 1, (bases + length(j) / 2.0) / max(total, 1.0) * n);
+		bases += length(j);
+		if(shard == k && shard_first == n_records) shard_first = j;
+		if(shard > k){
+			shard_last = j;
+			break;
+		}
+	}
+	return true;
+}
+
+
+bool FileReader::in_shard(const size_t number) const{
+	return number >= shard_first && number < shard_last && (number - shard_first) % shard_stride == 0;
+}
+
+
+// read the next record of the shard; returns false at end of file
+bool FileReader::next(string_view &seq_name, string_view &seq){
+	// indexed records out of the shard are skipped without reading them
+	if(indexed){
+		const size_t skip = (next_record > shard_first ? (next_record - shard_first + shard_stride - 1) / shard_stride * shard_stride : 0);
+		next_record = min(shard_first + skip, shard_last);
+		n_passed = next_record;
+	}
+	while(n_passed < shard_last && read_record(seq_name, seq)){
+		if(in_shard(n_passed++)) return true;
+	}
+	return false;
+}
+
+
+// read the next record; returns false at end of file
+// lines before the first header are ignored
+bool FileReader::read_record(string_view &seq_name, string_view &seq){
+	if(indexed){
+		const size_t n = (has_selection ? selected.size() : index.size());
+		if(next_record >= n) return false;
+		const size_t i = (has_selection ? selected[next_record] : next_record);
+		seq_name = name(i);
+		seq = sequence(i, seq_buffer);
+		next_record++;
+		return true;
+	}
+
+	while(!has_header && next_line(header)){
+		has_header = (!header.empty() && header[0] == '>');
+	}
+	if(!has_header) return false;
+
+	if(file.is_open()){
+		seq_name = header.substr(1);
+	}else{
+		name_buffer.assign(header.substr(1));
+		seq_name = name_buffer;
+	}
+
+	// a single mapped line is returned as is; more lines, or stream lines
+	// (overwritten by the next getline), are joined in seq_buffer
+	bool joined = !file.is_open();
+	int n_lines = 0;
+	string_view line_view;
+	seq = {};
+	seq_buffer.clear();
+	has_header = false;
+	while(next_line(line_view)){
+		if(line_view.empty()) continue;
+		if(line_view[0] == '>'){
+			header = line_view;
+			has_header = true;
+			break;
 		}
+		if(n_lines == 1 && !joined){
+			seq_buffer.assign(seq);
+			joined = true;
+		}
+		if(joined) seq_buffer += line_view;
+		else seq = line_view;
+		n_lines++;
 	}
+	// a record cut off by truncated / corrupt compressed input is dropped,
+	// so it is never folded as if it were complete
+	if(!has_header && failed()) return false;
+	if(joined) seq = seq_buffer;
+	return true;
+}
+
 
-	ifs.close();
+// next line without trailing whitespace; the view stays valid until the next call
+bool FileReader::next_line(string_view &line_view){
+	if(file.is_open()){
+		if(pos >= file.size()) return false;
+		const char *begin = file.data() + pos;
+		const char *end = (const char*)memchr(begin, '\n', file.size() - pos);
+		if(!end) end = file.data() + file.size();
+		line_view = string_view(begin, end - begin);
+		pos = end - file.data() + 1;
+	}else{
+		if(!getline(*in, line)) return false;
+		line_view = line;
+	}
+	trim_end(line_view);
 	return true;
-}
\ No newline at end of file
+}
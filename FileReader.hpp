@@ -1,6 +1,13 @@
 #pragma once
 
+#include "mapped_file.hpp"
+#include "gzip_reader.hpp"
+#include "fasta_index.hpp"
+
+#include <cstdint>
+#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 using namespace std;
@@ -9,4 +16,85 @@ class FileReader{
 public:
 	FileReader(){}
 	bool read(const string file_name, vector<string> &seq, vector<string> &seq_name);
-};
\ No newline at end of file
+
+	// streaming interface: open(), then next() yields one record at a time
+	// regular files are mmapped, gzip / BGZF files are decompressed on
+	// background threads (decompress_threads, 0: all cores), anything else
+	// (pipes, ...) is read line by line
+	bool open(const string &file_name, int decompress_threads = 0);
+	bool next(string &seq_name, string &seq);
+
+	// zero-copy variant: views point into the mapped file where possible and
+	// stay valid until the next call
+	bool next(string_view &seq_name, string_view &seq);
+
+	// returns whether the input ended early (truncated / corrupt compressed input)
+	bool failed() const;
+
+	// build the record table of mmapped input on threads, after which next()
+	// walks the table; returns false for input that is not mmapped
+	bool build_index(int threads);
+	bool has_index() const{ return indexed; }
+	size_t n_records() const{ return index.size(); }
+
+	// like build_index(), but reuse <input>.fai if it is at least as new as the
+	// input, and write it otherwise
+	bool use_fai(int threads);
+
+	// index of the record named key (first word of the header, or the whole header)
+	bool find(string_view key, size_t &i){ return index.find(file, key, i); }
+
+	// make next() yield only records ids, in this order
+	void select(vector<size_t> ids);
+
+	// make next() yield only shard k (0-based) of n: the records numbered
+	// k, k + n, k + 2n, ... in input (or selection) order
+	void set_shard(size_t k, size_t n);
+	// like set_shard(), but shard k is a contiguous run of records with about
+	// 1 / n of the bases; needs the record table
+	bool set_shard_by_length(size_t k, size_t n);
+
+	// number of the record last returned by next() in input (or selection)
+	// order, records of other shards included
+	size_t record_number() const{ return n_passed - 1; }
+
+	// direct access to indexed records; safe to call from several threads
+	// with separate buffers
+	string_view name(const size_t i) const{ return index.name(file, i); }
+	string_view sequence(const size_t i, string &buffer) const{ return index.sequence(file, i, buffer); }
+private:
+	// mmap input
+	MappedFile file;
+	size_t pos = 0;
+
+	// record table of mmapped input
+	string file_name;
+	FastaIndex index;
+	bool indexed = false;
+	size_t next_record = 0;
+	vector<size_t> selected;
+	bool has_selection = false;
+
+	// records read so far, in or out of the shard
+	size_t n_passed = 0;
+	// shard: records shard_first <= number < shard_last, every shard_stride-th
+	size_t shard_first = 0, shard_last = SIZE_MAX, shard_stride = 1;
+
+	// stream input, from ifs or gz
+	ifstream ifs;
+	GzipStreamBuf gz;
+	istream gz_stream{nullptr};
+	istream *in = nullptr;
+	string line;
+
+	// header of the next record, read ahead by the previous call
+	string_view header;
+	bool has_header = false;
+
+	// sequence lines joined for multi-line records, name for stream input
+	string seq_buffer, name_buffer;
+
+	bool read_record(string_view &seq_name, string_view &seq);
+	bool in_shard(const size_t number) const;
+	bool next_line(string_view &line_view);
+};
@@ -3,15 +3,53 @@
 
 #include <fstream>
 #include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <iostream>
+
+namespace {
+
+// states per block of a parallel cell expansion
+const int BLOCK_STATES = 16;
+// position blocks per section of a parallel profile pass
+const int PROFILE_BLOCKS = 8;
+// heap bytes of one unordered_map<int, Float> node: next pointer and
+// key/value, rounded up by malloc
+const size_t MAP_NODE_BYTES = 32;
+// shorter sequences keep their cells in memory with a spill directory: their
+// tables are small, and the file costs more than it saves
+const int SPILL_MIN_LENGTH = 10000;
+// columns an inside step adds to: its own and the next MAXLOOP (SE) or
+// MULTI_MAX_UNPAIRED (M2) ones
+const int CHECKPOINT_COLUMNS = max(MAXLOOP, MULTI_MAX_UNPAIRED) + 1;
+
+} // namespace
 
 LinCapR::LinCapR(int beam_size, energy::Model model)
-	: params(energy::get_params(model)), beam_size(beam_size){
+	: LinCapR(beam_size, energy::get_params(model)){}
+
+// params must outlive this engine
+LinCapR::LinCapR(int beam_size, const energy::Params &params)
+	: params(params), loops(energy::pack_loop_tables(params)), beam_size(beam_size){
 	if(params.use_fast_logsumexp) set_logsumexp_fast_mode();
 	else set_logsumexp_legacy_mode();
 }
 
 
+void LinCapR::set_threads(int threads){
+	if(threads > 1) pool = make_unique<ForkJoinPool>(threads);
+	else pool.reset();
+}
+
+
+bool LinCapR::set_spill_dir(const string &dir){
+	spill = make_unique<SpillFile>();
+	if(spill->open(dir)) return true;
+	spill.reset();
+	return false;
+}
+
+
 // prune top-k states
 Float LinCapR::prune(Map<int, Float> &states) const{
 	return lcr::beam::prune_states(states, beam_size,
@@ -22,47 +60,29 @@ Float LinCapR::prune(Map<int, Float> &states) const{
 
 
 // output structural profile
-void LinCapR::output(ofstream &ofs, const string &seq_name) const{
-	ofs << ">" + seq_name << endl;
-
-	ofs << "Bulge ";
-	for(int i = 0; i < seq_n; i++) ofs << prob_B[i] << " ";
-	ofs << endl;
-
-	ofs << "Exterior ";
-	for(int i = 0; i < seq_n; i++) ofs << prob_E[i] << " ";
-	ofs << endl;
-
-	ofs << "Hairpin ";
-	for(int i = 0; i < seq_n; i++) ofs << prob_H[i] << " ";
-	ofs << endl;
-
-	ofs << "Internal ";
-	for(int i = 0; i < seq_n; i++) ofs << prob_I[i] << " ";
-	ofs << endl;
-
-	ofs << "Multiloop ";
-	for(int i = 0; i < seq_n; i++) ofs << prob_M[i] << " ";
-	ofs << endl;
-
-	ofs << "Stem ";
-	for(int i = 0; i < seq_n; i++) ofs << prob_S[i] << " ";
-	ofs << endl;
-
-	ofs << endl;
+void LinCapR::get_profile(Profile &profile, string_view seq_name){
+	profile.name = seq_name;
+	for(int i = 0; i < NPROBS; i++){
+		profile.probs[i].clear();
+		swap(profile.probs[i], *probs[i]);
+	}
 }
 
 
 // clear temp tables & profiles
 void LinCapR::clear(){
-	seq = "";
+	seq = {};
 	seq_int.clear();
 	seq_n = 0;
 
 	for(int i = 0; i < NTABLES; i++){
 		alphas[i]->clear();
 		betas[i]->clear();
+		frozen[i].clear();
 	}
+	if(spilling) spill->reset(0);
+	spilling = false;
+	vector<Checkpoint>().swap(checkpoints);
 
 	for(int i = 0; i < NPROBS; i++) probs[i]->clear();
 }
@@ -74,17 +94,62 @@ Float LinCapR::get_energy_ensemble() const{
 }
 
 
+size_t LinCapR::memory_usage() const{
+	size_t bytes = 0;
+	for(int t = 0; t < NTABLES; t++){
+		for(const Table *table : {alphas[t], betas[t]}){
+			bytes += table->size() * sizeof(Map<int, Float>);
+			for(const auto &cell : *table) bytes += cell.size() * MAP_NODE_BYTES + cell.bucket_count() * sizeof(void*);
+		}
+		bytes += frozen[t].memory_usage();
+	}
+	bytes += checkpoint_bytes;
+	bytes += (alpha_O.size() + beta_O.size()) * sizeof(Float);
+	for(int i = 0; i < NPROBS; i++) bytes += probs[i]->size() * sizeof(Float);
+	for(int i = 0; i < NBASE; i++) bytes += next_pair[i].size() * sizeof(int);
+	return bytes + seq_int.size() * sizeof(int);
+}
+
+
 // calc structural profile
-void LinCapR::run(const string &seq){
+bool LinCapR::run(string_view seq){
 	initialize(seq);
-	calc_inside();
-	calc_outside();
+	if(!calc_inside()) return false;
+	if(energy_only) return true;
+	if(spilling && !spill->finish()){
+		cout << "Warning: cannot write spill file, folding in memory" << endl;
+		clear();
+		spill.reset();
+		initialize(seq);
+		if(!calc_inside()) return false;
+	}
+	for(int t = 0; t < NTABLES; t++) frozen[t].finish();
+
+	if(!calc_outside()) return false;
 	calc_profile();
+	return true;
+}
+
+
+void LinCapR::set_budget(const double seconds, const size_t states){
+	time_budget = seconds;
+	state_budget = states;
+}
+
+
+// count the inside states of position j (call when j is done, 0 for the
+// outside pass) and check the budgets
+bool LinCapR::within_budget(const int j){
+	if(j >= 0){
+		for(int t = 0; t < NTABLES; t++) kept_states += alphas[t]->at(j).size();
+	}
+	if(state_budget > 0 && kept_states > state_budget) return false;
+	return time_budget <= 0 || chrono::steady_clock::now() < deadline;
 }
 
 
 // initialize
-void LinCapR::initialize(const string &seq){
+void LinCapR::initialize(string_view seq){
 	this->seq = seq;
 
 	// integerize sequence
@@ -109,11 +174,30 @@ void LinCapR::initialize(const string &seq){
 	betas[4] = &beta_M1;
 	betas[5] = &beta_M2;
 
-	alpha_O.resize(seq_n, -INF);
-	beta_O.resize(seq_n, -INF);
+	kept_states = 0;
+	if(time_budget > 0) deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(time_budget));
+
+	// the segment that balances the checkpoints against the recomputed columns
+	segment_length = (energy_only ? 0 : checkpoint_interval);
+	if(segment_length == CHECKPOINT_AUTO) segment_length = sqrt((double)CHECKPOINT_COLUMNS * seq_n);
+	if(segment_length >= seq_n) segment_length = 0;
+	checkpoint_bytes = 0;
+
+	spilling = (spill && !energy_only && seq_n >= SPILL_MIN_LENGTH);
+	if(spilling) spill->reset(seq_n);
+	// M1 cells are read at random by the bifurcations, and recomputed segments
+	// are frozen after the file is written: they stay in memory
+	for(int t = 0; t < NTABLES; t++){
+		const bool to_file = spilling && t != TABLE_M1 && !(segment_length > 0 && recomputed(t));
+		frozen[t].reset(seq_n, (to_file ? spill.get() : nullptr));
+	}
+
+	// the energy needs neither outside tables nor profiles
+	alpha_O.assign(seq_n, -INF);
+	if(!energy_only) beta_O.assign(seq_n, -INF);
 	for(int i = 0; i < NTABLES; i++){
 		alphas[i]->resize(seq_n);
-		betas[i]->resize(seq_n);
+		if(!energy_only) betas[i]->resize(seq_n);
 		// google hash
 		// for(int j = 0; j < seq_n; j++){
 		// 	alphas[i]->at(j).set_empty_key(-1);
@@ -131,10 +215,12 @@ void LinCapR::initialize(const string &seq){
 	probs[4] = &prob_M;
 	probs[5] = &prob_S;
 
-	for(int i = 0; i < NPROBS; i++) probs[i]->resize(seq_n);
+	if(!energy_only){
+		for(int i = 0; i < NPROBS; i++) probs[i]->resize(seq_n);
+	}
 
 	// calc next pair index
-	for(int i = 0; i < NBASE; i++) next_pair[i].resize(seq_n + 1, seq_n);
+	for(int i = 0; i < NBASE; i++) next_pair[i].assign(seq_n + 1, seq_n);
 	for(int i = seq_n - 1; i >= 0; i--){
 		for(int j = 0; j < NBASE; j++){
 			next_pair[j][i] = next_pair[j][i + 1];
@@ -144,113 +230,228 @@ void LinCapR::initialize(const string &seq){
 }
 
 
-// calc inside variables
-void LinCapR::calc_inside(){
+// calls body(i, score, sums) for every state of a cell; sums(t, i, j, score)
+// adds to tables[t][i, j] and sums.outer(i, score) to O[i]
+// cells with enough states are expanded in parallel blocks whose sums are
+// merged in block order, which depends only on the cell, not on the threads
+template<class States, class Body>
+void LinCapR::expand(const States &states, Table **tables, vector<Float> &O, Body body){
+	if(!pool || (int)states.size() < 2 * BLOCK_STATES){
+		DirectSums sums{tables, O};
+		for(const auto [i, score] : states) body(i, score, sums);
+		return;
+	}
+
+	block_states.assign(states.begin(), states.end());
+	const int n_states = block_states.size();
+	const int n_blocks = (n_states + BLOCK_STATES - 1) / BLOCK_STATES;
+	if((int)block_sums.size() < n_blocks) block_sums.resize(n_blocks);
+	pool->run(n_blocks, [&](const int b){
+		BlockSums &sums = block_sums[b];
+		for(int s = b * BLOCK_STATES; s < min(n_states, (b + 1) * BLOCK_STATES); s++){
+			body(block_states[s].first, block_states[s].second, sums);
+		}
+	});
+
+	// the sums are swapped for fresh maps (clear() and = {} keep the buckets):
+	// the iteration order of a reused map would depend on the records folded
+	// before, and so would the insertion order into the tables
+	for(int b = 0; b < n_blocks; b++){
+		BlockSums &sums = block_sums[b];
+		for(int t = 0; t < NTABLES; t++){
+			for(const auto [key, score] : sums.cells[t]) update_sum(*tables[t], key & UINT32_MAX, key >> 32, score);
+			Map<uint64_t, Float>().swap(sums.cells[t]);
+		}
+		for(const auto [i, score] : sums.O) update_sum(O, i, score);
+		Map<int, Float>().swap(sums.O);
+	}
+}
+
+
+// calc inside variables; false if a budget is exceeded
+bool LinCapR::calc_inside(){
 	alpha_O[0] = 0;
 
 	for(int j = 0; j < seq_n; j++){
-		// S
-		prune(alpha_S[j]);
-		for(const auto [i, score] : alpha_S[j]){
-			// S -> S
-			if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
-				update_sum(alpha_S, i - 1, j + 1, score - energy_loop(i - 1, j + 1, i, j) / params.kT);
-			}
-			
-			// M2 -> S
-			for(int n = 0; n <= MULTI_MAX_UNPAIRED && j + n < seq_n; n++){
-				update_sum(alpha_M2, i, j + n, score - (energy_multi_bif(i, j) + energy_multi_unpaired(j + 1, j + n)) / params.kT);
-			}
+		if(segment_length > 0 && j % segment_length == 0) save_checkpoint(j);
+		calc_inside_at(j, false);
 
-			// SE -> S: p..i..j..q, [p - 1, q] can be pair
-			for(int p = i; i - p <= MAXLOOP && p >= 1; p--){
-				for(int q = next_pair[seq_int[p - 1]][j + 1]; q < seq_n && (q - j - 1) + (i - p) <= MAXLOOP; q = next_pair[seq_int[p - 1]][q + 1]){
-					if((p == i && q == j + 1)) continue;
-					update_sum(alpha_SE, p, q - 1, score - energy_loop(p - 1, q, i, j) / params.kT);
-				}
-			}
+		// O -> O
+		if(j + 1 < seq_n){
+			update_sum(alpha_O, j + 1, alpha_O[j] - energy_external_unpaired(j + 1, j + 1) / params.kT);
+		}
 
-			// O -> O + S
-			update_sum(alpha_O, j, (i - 1 >= 0 ? alpha_O[i - 1] : 0) + score - energy_external(i, j) / params.kT);
+		if(!within_budget(j)) return false;
+		// with energy_only, only the bifurcations read cells of passed positions
+		for(int t = 0; t < NTABLES; t++){
+			const bool dropped = (energy_only ? t != TABLE_M1 : segment_length > 0 && recomputed(t));
+			if(dropped) Map<int, Float>().swap((*alphas[t])[j]);
+			else frozen[t].freeze(j, (*alphas[t])[j]);
 		}
+	}
+	return true;
+}
+
 
-		// M2
-		prune(alpha_M2[j]);
-		for(const auto [i, score] : alpha_M2[j]){
+// the inside step of position j: prune its cells and add their sums to the
+// cells of later positions and to alpha_O. With recompute, only the sums into
+// the recomputed tables, from the kept S and MB cells of j
+void LinCapR::calc_inside_at(const int j, const bool recompute){
+	// S
+	auto expand_S = [&](const int i, const Float score, auto &sums){
+		// S -> S
+		if(!recompute && i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
+			sums(TABLE_S, i - 1, j + 1, score - energy_loop(i - 1, j + 1, i, j) / params.kT);
+		}
+		
+		// M2 -> S
+		for(int n = 0; n <= MULTI_MAX_UNPAIRED && j + n < seq_n; n++){
+			sums(TABLE_M2, i, j + n, score - (energy_multi_bif(i, j) + energy_multi_unpaired(j + 1, j + n)) / params.kT);
+		}
+
+		// SE -> S: p..i..j..q, [p - 1, q] can be pair
+		for(int p = i; i - p <= MAXLOOP && p >= 1; p--){
+			for(int q = next_pair[seq_int[p - 1]][j + 1]; q < seq_n && (q - j - 1) + (i - p) <= MAXLOOP; q = next_pair[seq_int[p - 1]][q + 1]){
+				if((p == i && q == j + 1)) continue;
+				sums(TABLE_SE, p, q - 1, score - energy_loop(p - 1, q, i, j) / params.kT);
+			}
+		}
+
+		// O -> O + S
+		if(!recompute) sums.outer(j, (i - 1 >= 0 ? alpha_O[i - 1] : 0) + score - energy_external(i, j) / params.kT);
+	};
+	if(recompute) expand(frozen[TABLE_S][j], alphas, alpha_O, expand_S);
+	else{
+		prune(alpha_S[j]);
+		expand(alpha_S[j], alphas, alpha_O, expand_S);
+	}
+
+	// M2
+	prune(alpha_M2[j]);
+	if(!recompute){
+		expand(alpha_M2[j], alphas, alpha_O, [&](const int i, const Float score, auto &sums){
 			// M1 -> M2
-			update_sum(alpha_M1, i, j, score);
+			sums(TABLE_M1, i, j, score);
 
 			// MB -> M1 + M2
 			if(i - 1 >= 0){
-				for(const auto [k, score_m1] : alpha_M1[i - 1]){
-					update_sum(alpha_MB, k, j, score_m1 + score);
+				for(const auto [k, score_m1] : frozen[TABLE_M1][i - 1]){
+					sums(TABLE_MB, k, j, score_m1 + score);
 				}
 			}
-		}
+		});
+	}
 
-		// MB
-		prune(alpha_MB[j]);
-		for(const auto [i, score] : alpha_MB[j]){
-			// M1 -> MB
-			update_sum(alpha_M1, i, j, score);
+	// MB
+	auto expand_MB = [&](const int i, const Float score, auto &sums){
+		// M1 -> MB
+		if(!recompute) sums(TABLE_M1, i, j, score);
 
-			// M -> MB
-			for(int n = 0; n <= MULTI_MAX_UNPAIRED && i - n >= 0; n++){
-				update_sum(alpha_M, i - n, j, score);
-			}
+		// M -> MB
+		for(int n = 0; n <= MULTI_MAX_UNPAIRED && i - n >= 0; n++){
+			sums(TABLE_M, i - n, j, score);
 		}
+	};
+	if(recompute) expand(frozen[TABLE_MB][j], alphas, alpha_O, expand_MB);
+	else{
+		prune(alpha_MB[j]);
+		expand(alpha_MB[j], alphas, alpha_O, expand_MB);
 
 		// M1
 		prune(alpha_M1[j]);
+	}
 
-		// M
-		prune(alpha_M[j]);
-		for(const auto [i, score] : alpha_M[j]){
-			// SE -> M
-			if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
-				update_sum(alpha_SE, i, j, score - energy_multi_closing(i - 1, j + 1) / params.kT);
-			}
+	// M
+	prune(alpha_M[j]);
+	for(const auto [i, score] : alpha_M[j]){
+		// SE -> M
+		if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
+			update_sum(alpha_SE, i, j, score - energy_multi_closing(i - 1, j + 1) / params.kT);
 		}
+	}
 
-		// SE -> (Hairpin)
-		for(int n = TURN; n <= MAXLOOP; n++){
-			const int i = j - n + 1;
-			if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
-				update_sum(alpha_SE, i, j, -energy_hairpin(i - 1, j + 1) / params.kT);
-			}
+	// SE -> (Hairpin)
+	for(int n = TURN; n <= MAXLOOP; n++){
+		const int i = j - n + 1;
+		if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
+			update_sum(alpha_SE, i, j, -energy_hairpin(i - 1, j + 1) / params.kT);
 		}
+	}
 
-		// SE
-		prune(alpha_SE[j]);
-		for(const auto [i, score] : alpha_SE[j]){
-			// S -> SE
-			if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
-				update_sum(alpha_S, i - 1, j + 1, score);
-			}
+	// SE
+	prune(alpha_SE[j]);
+	if(recompute) return;
+	for(const auto [i, score] : alpha_SE[j]){
+		// S -> SE
+		if(i - 1 >= 0 && j + 1 < seq_n && can_pair(i - 1, j + 1)){
+			update_sum(alpha_S, i - 1, j + 1, score);
 		}
+	}
+}
 
-		// O -> O
-		if(j + 1 < seq_n){
-			update_sum(alpha_O, j + 1, alpha_O[j] - energy_external_unpaired(j + 1, j + 1) / params.kT);
+
+// copy the cells of the recomputed tables that the inside pass carries into
+// position j and later
+void LinCapR::save_checkpoint(const int j){
+	Checkpoint &checkpoint = checkpoints.emplace_back();
+	checkpoint.j = j;
+	const int end = min(seq_n, j + CHECKPOINT_COLUMNS);
+	for(int t = 0; t < NTABLES; t++){
+		if(!recomputed(t)) continue;
+		// copies keep the maps' iteration order, so the recomputed sums are the same
+		checkpoint.columns[t].assign(alphas[t]->begin() + j, alphas[t]->begin() + end);
+		for(const auto &cell : checkpoint.columns[t]) checkpoint_bytes += cell.size() * MAP_NODE_BYTES + cell.bucket_count() * sizeof(void*);
+	}
+}
+
+
+// recompute the SE, M and M2 columns of segment k from its checkpoint, in
+// place of those of segment k + 1; false if the time budget is exceeded
+bool LinCapR::recompute_segment(const int k){
+	Checkpoint &checkpoint = checkpoints[k];
+	const int from = checkpoint.j, to = min(seq_n, from + segment_length);
+	for(int t = 0; t < NTABLES; t++){
+		if(!recomputed(t)) continue;
+		frozen[t].release();
+		for(size_t c = 0; c < checkpoint.columns[t].size(); c++) (*alphas[t])[from + c].swap(checkpoint.columns[t][c]);
+		vector<Map<int, Float>>().swap(checkpoint.columns[t]);
+	}
+
+	for(int j = from; j < to; j++){
+		calc_inside_at(j, true);
+		if(!within_budget(-1)) return false;
+		for(int t = 0; t < NTABLES; t++){
+			if(recomputed(t)) frozen[t].freeze(j, (*alphas[t])[j]);
 		}
 	}
+	// sums added past the segment were added before
+	for(int j = to; j < min(seq_n, to + CHECKPOINT_COLUMNS); j++){
+		for(int t = 0; t < NTABLES; t++) Map<int, Float>().swap((*alphas[t])[j]);
+	}
+	return true;
 }
 
 
-// calc outside variables
-void LinCapR::calc_outside(){
+// calc outside variables; false if a budget is exceeded
+bool LinCapR::calc_outside(){
+	int segment = checkpoints.size();
 	for(int j = seq_n - 1; j >= 0; j--){
+		if(spilling) spill->advise_backward(j);
+		if(segment > 0 && j < checkpoints[segment - 1].j + segment_length){
+			if(!recompute_segment(--segment)) return false;
+		}
+
 		// O
 		// O -> O
 		update_sum(beta_O, j, (j + 1 < seq_n ? beta_O[j + 1] : 0) - energy_external_unpaired(j + 1, j + 1) / params.kT);
 		
 		// O -> O + S
-		for(const auto [i, score] : alpha_S[j]){
+		for(const auto [i, score] : frozen[TABLE_S][j]){
 			update_sum(beta_O, i, score + (j + 1 < seq_n ? beta_O[j + 1] : 0) - energy_external(i, j) / params.kT);
 		}
 
 		// SE
-		for(const auto [i, _] : alpha_SE[j]){
+		for(const auto [i, _] : frozen[TABLE_SE][j]){
 			// S -> SE
 			if(i - 1 >= 0 && j + 1 < seq_n){
 				update_sum(beta_SE, i, j, get_value(beta_S, i - 1, j + 1));
@@ -258,7 +459,7 @@ void LinCapR::calc_outside(){
 		}
 
 		// M
-		for(const auto [i, _] : alpha_M[j]){
+		for(const auto [i, _] : frozen[TABLE_M][j]){
 			// SE -> M
 			if(i - 1 >= 0 && j + 1 < seq_n){
 				update_sum(beta_M, i, j, get_value(beta_SE, i, j) - energy_multi_closing(i - 1, j + 1) / params.kT);
@@ -266,129 +467,194 @@ void LinCapR::calc_outside(){
 		}
 
 		// MB
-		for(const auto [i, _] : alpha_MB[j]){
+		expand(frozen[TABLE_MB][j], betas, beta_O, [&](const int i, const Float, auto &sums){
 			// M1 -> MB
-			update_sum(beta_MB, i, j, get_value(beta_M1, i, j));
+			sums(TABLE_MB, i, j, get_value(beta_M1, i, j));
 
 			// M -> MB
 			for(int n = 0; n <= MULTI_MAX_UNPAIRED && i - n >= 0; n++){
-				update_sum(beta_MB, i, j, get_value(beta_M, i - n, j));
+				sums(TABLE_MB, i, j, get_value(beta_M, i - n, j));
 			}
-		}
+		});
 
 		// M1, M2
-		for(const auto [i, score_M2] : alpha_M2[j]){
+		expand(frozen[TABLE_M2][j], betas, beta_O, [&](const int i, const Float score_M2, auto &sums){
 			// M1 -> M2
-			update_sum(beta_M2, i, j, get_value(beta_M1, i, j));
+			sums(TABLE_M2, i, j, get_value(beta_M1, i, j));
 
 			// MB -> M1 + M2
-			if(i - 1 < 0) continue;
-			for(const auto [k, score_M1] : alpha_M1[i - 1]){
-				update_sum(beta_M1, k, i - 1, get_value(beta_MB, k, j) + score_M2);
-				update_sum(beta_M2, i, j, get_value(beta_MB, k, j) + score_M1);
+			if(i - 1 < 0) return;
+			for(const auto [k, score_M1] : frozen[TABLE_M1][i - 1]){
+				sums(TABLE_M1, k, i - 1, get_value(beta_MB, k, j) + score_M2);
+				sums(TABLE_M2, i, j, get_value(beta_MB, k, j) + score_M1);
 			}
-		}
+		});
 
 		// S
-		for(const auto [i, _] : alpha_S[j]){
+		expand(frozen[TABLE_S][j], betas, beta_O, [&](const int i, const Float, auto &sums){
 			// O -> O + S
-			update_sum(beta_S, i, j, (i - 1 >= 0 ? alpha_O[i - 1] : 0) + (j + 1 < seq_n ? beta_O[j + 1] : 0) - energy_external(i, j) / params.kT);
+			sums(TABLE_S, i, j, (i - 1 >= 0 ? alpha_O[i - 1] : 0) + (j + 1 < seq_n ? beta_O[j + 1] : 0) - energy_external(i, j) / params.kT);
 
 			// SE -> S
 			for(int p = i; i - p <= MAXLOOP && p >= 1; p--){
 				for(int q = next_pair[seq_int[p - 1]][j + 1]; q < seq_n && (q - j - 1) + (i - p) <= MAXLOOP; q = next_pair[seq_int[p - 1]][q + 1]){
 					if((p == i && q == j + 1)) continue;
-					update_sum(beta_S, i, j, get_value(beta_SE, p, q - 1) - energy_loop(p - 1, q, i, j) / params.kT);
+					sums(TABLE_S, i, j, get_value(beta_SE, p, q - 1) - energy_loop(p - 1, q, i, j) / params.kT);
 				}
 			}
 
 			// S -> S
 			if(i - 1 >= 0 && j + 1 < seq_n){
-				update_sum(beta_S, i, j, get_value(beta_S, i - 1, j + 1) - energy_loop(i - 1, j + 1, i, j) / params.kT);
+				sums(TABLE_S, i, j, get_value(beta_S, i - 1, j + 1) - energy_loop(i - 1, j + 1, i, j) / params.kT);
 			}
 			
 			// M2 -> S
 			for(int n = 0; n <= MULTI_MAX_UNPAIRED && j + n < seq_n; n++){
-				update_sum(beta_S, i, j, get_value(beta_M2, i, j + n) - (energy_multi_bif(i, j) + energy_multi_unpaired(j + 1, j + n)) / params.kT);
+				sums(TABLE_S, i, j, get_value(beta_M2, i, j + n) - (energy_multi_bif(i, j) + energy_multi_unpaired(j + 1, j + n)) / params.kT);
 			}
-		}
+		});
+
+		if(!within_budget(-1)) return false;
 	}
+	return true;
 }
 
 
 // calc structural profile
 void LinCapR::calc_profile(){
 	const Float logZ = alpha_O[seq_n - 1];
+	if(spilling) spill->advise_forward();
+
+	if(pool) calc_profile_blocks(logZ);
+	else{
+		profile_loops(0, seq_n, logZ, prob_B, prob_H, prob_I);
+		prefix_sum(prob_B);
+		prefix_sum(prob_H);
+		prefix_sum(prob_I);
+
+		profile_multi(0, seq_n, logZ, prob_M);
+		prefix_sum(prob_M);
+
+		profile_stem(0, seq_n, logZ, prob_S);
+	}
+
+	// E
+	prob_E[0] = exp(beta_O[1] - logZ);
+	prob_E[seq_n - 1] = exp(alpha_O[seq_n - 2] - logZ);
+	for(int i = 1; i < seq_n - 1; i++){
+		prob_E[i] = exp(alpha_O[i - 1] + beta_O[i + 1] - logZ);
+	}
+
+	// regularize
+	for(int i = 0; i < seq_n; i++){
+		Float sum_prob_i = 0;
+		for(int j = 0; j < NPROBS; j++){
+			// negative probabilities to 0
+			if(probs[j]->at(i) < 0) probs[j]->at(i) = 0;
+			sum_prob_i += probs[j]->at(i);
+		}
 
-	for(int k = 0; k < seq_n; k++){
+		// sum of probabilities to 1
+		for(int j = 0; j < NPROBS; j++) probs[j]->at(i) /= sum_prob_i;
+	}
+}
+
+
+// the sections of calc_profile over the outer positions [from, to); each
+// adds only to the vectors it is given
+
+// H, B, I: unpaired bases closed by the pair (j - 1, k + 1)
+void LinCapR::profile_loops(const int from, const int to, const Float logZ, vector<Float> &B, vector<Float> &H, vector<Float> &I) const{
+	for(int k = from; k < to; k++){
 		for(const auto [j, score] : beta_SE[k]){
 			// H
-			add_range(prob_H, j, k, exp(score - energy_hairpin(j - 1, k + 1) / params.kT - logZ));
+			add_range(H, j, k, exp(score - energy_hairpin(j - 1, k + 1) / params.kT - logZ));
 
 			// B, I
 			for(int p = j; p <= min(j + MAXLOOP, k - 1); p++){
 				for(int q = k; q >= p + TURN + 1 && (p - j) + (k - q) <= MAXLOOP; q--){
-					if((p == j && q == k) || !contains(alpha_S, p, q)) continue;
-					const Float new_score = exp(score + alpha_S[q][p] - energy_loop(j - 1, k + 1, p, q) / params.kT - logZ);
-					add_range((q == k ? prob_B : prob_I), j, p - 1, new_score);
-					add_range((p == j ? prob_B : prob_I), q + 1, k, new_score);
+					if(p == j && q == k) continue;
+					const Float *score_pq = frozen[TABLE_S][q].find(p);
+					if(!score_pq) continue;
+					const Float new_score = exp(score + *score_pq - energy_loop(j - 1, k + 1, p, q) / params.kT - logZ);
+					add_range((q == k ? B : I), j, p - 1, new_score);
+					add_range((p == j ? B : I), q + 1, k, new_score);
 				}
 			}
 		}
 	}
-	prefix_sum(prob_B);
-	prefix_sum(prob_H);
-	prefix_sum(prob_I);
+}
 
-	// M
-	for(int k = 0; k < seq_n; k++){
-		for(const auto [p, score] : alpha_MB[k]){
+
+// M: unpaired bases of multiloops, left of a branch and right of the last one
+void LinCapR::profile_multi(const int from, const int to, const Float logZ, vector<Float> &M) const{
+	for(int k = from; k < to; k++){
+		for(const auto [p, score] : frozen[TABLE_MB][k]){
 			for(int j = p - 1; j >= max(0, p - MAXLOOP); j--){
-				if(!contains(beta_M, j, k)) continue;
-				const Float new_score = exp(score + beta_M[k][j] - energy_multi_unpaired(j, p - 1) / params.kT - logZ);
-				add_range(prob_M, j, p - 1, new_score);
+				const auto it = beta_M[k].find(j);
+				if(it == beta_M[k].end()) continue;
+				const Float new_score = exp(score + it->second - energy_multi_unpaired(j, p - 1) / params.kT - logZ);
+				add_range(M, j, p - 1, new_score);
 			}
 		}
 	}
-	for(int q = 0; q < seq_n; q++){
-		for(const auto [j, score] : alpha_S[q]){
+	for(int q = from; q < to; q++){
+		for(const auto [j, score] : frozen[TABLE_S][q]){
 			for(int k = q + 1; k <= min(seq_n - 1, q + MAXLOOP); k++){
-				if(!contains(beta_M2, j, k)) continue;
-				const Float new_score = exp(score + beta_M2[k][j] - (energy_multi_bif(j, q) + energy_multi_unpaired(q + 1, k)) / params.kT - logZ);
-				add_range(prob_M, q + 1, k, new_score);
+				const auto it = beta_M2[k].find(j);
+				if(it == beta_M2[k].end()) continue;
+				const Float new_score = exp(score + it->second - (energy_multi_bif(j, q) + energy_multi_unpaired(q + 1, k)) / params.kT - logZ);
+				add_range(M, q + 1, k, new_score);
 			}
 		}
 	}
-	prefix_sum(prob_M);
+}
 
-	// S
-	for(int j = 0; j < seq_n; j++){
-		for(const auto [i, score] : alpha_S[j]){
-			const Float new_score = exp(score + beta_S[j][i] - logZ);
-			prob_S[i] += new_score;
-			prob_S[j] += new_score;
+
+// S: paired bases
+void LinCapR::profile_stem(const int from, const int to, const Float logZ, vector<Float> &S) const{
+	for(int j = from; j < to; j++){
+		for(const auto [i, score] : frozen[TABLE_S][j]){
+			// a pair without outside score counts as exp(score - logZ), as
+			// the original beta_S[j][i] lookup did
+			const Float new_score = exp(score + get_value(beta_S, i, j, 0) - logZ);
+			S[i] += new_score;
+			S[j] += new_score;
 		}
 	}
+}
 
-	// E
-	prob_E[0] = exp(beta_O[1] - logZ);
-	prob_E[seq_n - 1] = exp(alpha_O[seq_n - 2] - logZ);
-	for(int i = 1; i < seq_n - 1; i++){
-		prob_E[i] = exp(alpha_O[i - 1] + beta_O[i + 1] - logZ);
-	}
 
-	// regularize
-	for(int i = 0; i < seq_n; i++){
-		Float sum_prob_i = 0;
-		for(int j = 0; j < NPROBS; j++){
-			// negative probabilities to 0
-			if(probs[j]->at(i) < 0) probs[j]->at(i) = 0;
-			sum_prob_i += probs[j]->at(i);
+// calc_profile on the pool: every section is split into PROFILE_BLOCKS blocks
+// of outer positions, each adding to its own difference arrays; the arrays
+// are summed in block order, so the result does not depend on the threads
+void LinCapR::calc_profile_blocks(const Float logZ){
+	enum{ PART_B, PART_H, PART_I, PART_M, PART_S, NPARTS };
+	const int n_blocks = min(PROFILE_BLOCKS, seq_n);
+	vector<vector<Float>> parts(NPARTS * n_blocks, vector<Float>(seq_n, 0));
+	auto part = [&](const int k, const int b) -> vector<Float>& { return parts[k * n_blocks + b]; };
+	auto block_begin = [&](const int b){ return (int)((int64_t)seq_n * b / n_blocks); };
+
+	// loops first: they are the most expensive section
+	pool->run(3 * n_blocks, [&](const int task){
+		const int b = task % n_blocks, from = block_begin(b), to = block_begin(b + 1);
+		switch(task / n_blocks){
+		case 0: profile_loops(from, to, logZ, part(PART_B, b), part(PART_H, b), part(PART_I, b)); break;
+		case 1: profile_multi(from, to, logZ, part(PART_M, b)); break;
+		default: profile_stem(from, to, logZ, part(PART_S, b)); break;
 		}
-
-		// sum of probabilities to 1
-		for(int j = 0; j < NPROBS; j++) probs[j]->at(i) /= sum_prob_i;
-	}
+	});
+
+	vector<Float> *targets[NPARTS] = {&prob_B, &prob_H, &prob_I, &prob_M, &prob_S};
+	pool->run(NPARTS, [&](const int k){
+		vector<Float> &v = *targets[k];
+		v = move(part(k, 0));
+		for(int b = 1; b < n_blocks; b++){
+			const vector<Float> &block = part(k, b);
+			for(int i = 0; i < seq_n; i++) v[i] += block[i];
+		}
+		if(k != PART_S) prefix_sum(v);
+	});
 }
 
 
@@ -405,8 +671,10 @@ int LinCapR::special_hairpin(const int i, const int j) const{
 
 	if(!loops_seq) return -1;
 
-	const string loop = seq.substr(i, d + 2);
-	const char *sp = strstr(loops_seq, loop.c_str());
+	char loop[16];
+	memcpy(loop, seq.data() + i, d + 2);
+	loop[d + 2] = '\0';
+	const char *sp = strstr(loops_seq, loop);
 	return (sp ? (sp - loops_seq) / (d + 3) : -1);
 }
 
@@ -437,8 +705,10 @@ Float LinCapR::energy_hairpin(const int i, const int j) const{
 
 
 // calc energy of loop [i, p, q, j]
+// packed tables are indexed by (type - 1), so non-canonical pairs are INF here
 Float LinCapR::energy_loop(const int i, const int j, const int p, const int q) const{
-	const int type1 = BP_pair[seq_int[i]][seq_int[j]], type2 = BP_pair[seq_int[q]][seq_int[p]];;
+	const int type1 = BP_pair[seq_int[i]][seq_int[j]] - 1, type2 = BP_pair[seq_int[q]][seq_int[p]] - 1;
+	if(type1 < 0 || type2 < 0) return INF;
 	const int d1 = p - i - 1, d2 = j - q - 1;
 	const int d = d1 + d2, dmin = min(d1, d2), dmax = max(d1, d2);
 	const int si = seq_int[i + 1];
@@ -448,39 +718,39 @@ Float LinCapR::energy_loop(const int i, const int j, const int p, const int q) c
 
 	if(dmax == 0){
 		// stack
-		return params.stack37[type1][type2];
+		return energy::unpack(loops.stack[type1][type2]);
 	}
 
 	if(dmin == 0){
 		// bulge
-		Float energy = (d <= MAXLOOP ? params.bulge37[d] : params.bulge37[30] + params.lxc37 * log(d / 30.));
+		Float energy = (d <= MAXLOOP ? energy::unpack(loops.bulge[d]) : energy::unpack(loops.bulge[30]) + params.lxc37 * log(d / 30.));
 
-		if(dmax == 1) energy += params.stack37[type1][type2];
+		if(dmax == 1) energy += energy::unpack(loops.stack[type1][type2]);
 		else{
-			if(type1 > 2) energy += params.TerminalAU37;
-			if(type2 > 2) energy += params.TerminalAU37;
+			if(type1 > 1) energy += params.TerminalAU37;
+			if(type2 > 1) energy += params.TerminalAU37;
 		}
 		return energy;
 	}
 
 	// internal
 	// specieal internal loops
-	if(d1 == 1 && d2 == 1) return (*params.int11_37)[type1][type2][si][sj];
-	if(d1 == 1 && d2 == 2) return (*params.int21_37)[type1][type2][si][sq][sj];
-	if(d1 == 2 && d2 == 1) return (*params.int21_37)[type2][type1][sq][si][sp];
-	if(d1 == 2 && d2 == 2) return (*params.int22_37)[type1][type2][si][sp][sq][sj];
+	if(d1 == 1 && d2 == 1) return energy::unpack(loops.int11[type1][type2][si][sj]);
+	if(d1 == 1 && d2 == 2) return energy::unpack(loops.int21[type1][type2][si][sq][sj]);
+	if(d1 == 2 && d2 == 1) return energy::unpack(loops.int21[type2][type1][sq][si][sp]);
+	if(d1 == 2 && d2 == 2) return energy::unpack(loops.int22[type1][type2][si][sp][sq][sj]);
 
 	// generic internal loop
-	Float energy =  (d <= MAXLOOP ? params.internal_loop37[d] : params.internal_loop37[30] + params.lxc37 * log(d / 30.));
+	Float energy =  (d <= MAXLOOP ? energy::unpack(loops.internal_loop[d]) : energy::unpack(loops.internal_loop[30]) + params.lxc37 * log(d / 30.));
 	energy += min(params.MAX_NINIO, params.ninio37 * (dmax - dmin));
 	
 	// mismatch: different for sizes
 	if(dmin == 1){ // 1xn
-		energy += params.mismatch1nI37[type1][si][sj] + params.mismatch1nI37[type2][sq][sp];
+		energy += energy::unpack(loops.mismatch1nI[type1][si][sj]) + energy::unpack(loops.mismatch1nI[type2][sq][sp]);
 	}else if(dmin == 2 && dmax == 3){ // 2x3
-		energy += params.mismatch23I37[type1][si][sj] + params.mismatch23I37[type2][sq][sp];
+		energy += energy::unpack(loops.mismatch23I[type1][si][sj]) + energy::unpack(loops.mismatch23I[type2][sq][sp]);
 	}else{ // others
-		energy += params.mismatchI37[type1][si][sj] + params.mismatchI37[type2][sq][sp];
+		energy += energy::unpack(loops.mismatchI[type1][si][sj]) + energy::unpack(loops.mismatchI[type2][sq][sp]);
 	}
 
 	return energy;
@@ -2,21 +2,73 @@
 
 #include "miscs.hpp"
 #include "energy_model.hpp"
+#include "packed_energy.hpp"
+#include "profile_writer.hpp"
+#include "fork_join.hpp"
+#include "frozen_table.hpp"
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 
 class LinCapR{
 public:
 	LinCapR(int beam_size, energy::Model model = energy::Model::Turner2004);
-	void run(const string&);
-	void output(ofstream&, const string&) const;
+	LinCapR(int beam_size, const energy::Params &params);
+	// fold seq; returns false if a budget (set_budget()) was exceeded, in which
+	// case there is no result and clear() must be called before the next run
+	bool run(string_view);
+	// moves the profile of the last run() into profile
+	void get_profile(Profile &profile, string_view seq_name);
 	void clear();
 	Float get_energy_ensemble() const;
+	// approximate heap bytes of the DP tables and profiles of the last run(),
+	// i.e. its peak footprint; call before clear()
+	size_t memory_usage() const;
+
+	// fold on threads threads: the expansions of large beam cells are split
+	// into blocks of states, and the blocks' sums are merged in block order, so
+	// results are the same for any threads >= 2 and agree with threads = 1 up
+	// to floating-point rounding
+	void set_threads(int threads);
+
+	// per-run budgets: wall time in seconds, and DP states (inside states kept
+	// after pruning); 0: no limit
+	void set_budget(double seconds, size_t states);
+	void set_beam_size(int beam_size){ this->beam_size = beam_size; }
+
+	// keep the inside cells of long sequences in a scratch file in dir
+	// instead of memory, except M1 (see frozen_table.hpp); false if no file
+	// can be created there
+	bool set_spill_dir(const string &dir);
+
+	// keep the SE, M and M2 inside cells only as checkpoints every positions
+	// positions and recompute them segment by segment in the outside pass;
+	// 0: keep every cell, CHECKPOINT_AUTO: about sqrt(MAXLOOP * length)
+	static const int CHECKPOINT_AUTO = -1;
+	void set_checkpoint_interval(int positions){ checkpoint_interval = positions; }
+
+	// fold for the ensemble energy only: run() stops after the inside pass,
+	// which frees the cells it has passed except M1, and get_profile() returns
+	// no probabilities
+	void set_energy_only(bool energy_only){ this->energy_only = energy_only; }
+
+	int get_beam_size() const{ return beam_size; }
 private:
 	const energy::Params &params;
-	const int beam_size;
+	const energy::PackedLoopTables loops;
+	int beam_size;
+
+	double time_budget = 0;
+	size_t state_budget = 0;
+	chrono::steady_clock::time_point deadline;
+	size_t kept_states;
+	bool within_budget(const int j);
 	
-	string seq;
+	// sequence being folded, only valid during run()
+	string_view seq;
 
 	// integerized sequence
 	int seq_n;
@@ -29,17 +81,74 @@ private:
 	vector<Float> alpha_O, beta_O;
 	Table alpha_S, alpha_SE, alpha_M, alpha_MB, alpha_M1, alpha_M2, *alphas[NTABLES];
 	Table beta_S, beta_SE, beta_M, beta_MB, beta_M1, beta_M2, *betas[NTABLES];
+	// alphas[t][j] after the inside pass is done with j
+	FrozenTable frozen[NTABLES];
+	unique_ptr<SpillFile> spill;
+	// whether the current run spills
+	bool spilling = false;
+
+	// checkpoint mode: the recomputed tables' cells of columns [j, j +
+	// CHECKPOINT_COLUMNS) when the inside pass reaches j, which is all it
+	// carries forward into them
+	struct Checkpoint{
+		int j;
+		vector<Map<int, Float>> columns[NTABLES];
+	};
+	int checkpoint_interval = 0;
+	// positions per segment of the current run, 0 if it keeps every cell
+	int segment_length = 0;
+	vector<Checkpoint> checkpoints;
+	size_t checkpoint_bytes = 0;
+
+	bool energy_only = false;
 
 	// calculated structural profiles
 	vector<Float> prob_B, prob_I, prob_H, prob_M, prob_E, prob_S, *probs[NPROBS];
 
 	Float prune(Map<int, Float>&) const;
 
+	// indices into alphas / betas
+	enum{ TABLE_S, TABLE_SE, TABLE_M, TABLE_MB, TABLE_M1, TABLE_M2 };
+
+	// targets of a state expansion: DirectSums updates the tables in place,
+	// BlockSums collects the sums of one block of states for a later merge
+	struct DirectSums{
+		Table **tables;
+		vector<Float> &O;
+		void operator()(const int t, const int i, const int j, const Float score){ update_sum(*tables[t], i, j, score); }
+		void outer(const int i, const Float score){ update_sum(O, i, score); }
+	};
+	struct BlockSums{
+		// key: j << 32 | i
+		Map<uint64_t, Float> cells[NTABLES];
+		Map<int, Float> O;
+		void operator()(const int t, const int i, const int j, const Float score){ add(cells[t], (uint64_t)j << 32 | (uint32_t)i, score); }
+		void outer(const int i, const Float score){ add(O, i, score); }
+		template<class K> static void add(Map<K, Float> &sums, const K key, const Float score){
+			const auto [it, inserted] = sums.try_emplace(key, score);
+			if(!inserted) it->second = logsumexp(it->second, score);
+		}
+	};
+
+	unique_ptr<ForkJoinPool> pool;
+	vector<BlockSums> block_sums;
+	vector<pair<int, Float>> block_states;
+	template<class States, class Body> void expand(const States &states, Table **tables, vector<Float> &O, Body body);
+
 	// executable functions
-	void initialize(const string &s);
-	void calc_inside();
-	void calc_outside();
+	void initialize(string_view s);
+	bool calc_inside();
+	void calc_inside_at(const int j, const bool recompute);
+	void save_checkpoint(const int j);
+	bool recompute_segment(const int k);
+	// tables recomputed from checkpoints; the others are kept
+	static bool recomputed(const int t){ return t == TABLE_SE || t == TABLE_M || t == TABLE_M2; }
+	bool calc_outside();
 	void calc_profile();
+	void calc_profile_blocks(const Float logZ);
+	void profile_loops(const int from, const int to, const Float logZ, vector<Float> &B, vector<Float> &H, vector<Float> &I) const;
+	void profile_multi(const int from, const int to, const Float logZ, vector<Float> &M) const;
+	void profile_stem(const int from, const int to, const Float logZ, vector<Float> &S) const;
 
 	// calc each energy
 	Float energy_hairpin(const int, const int) const;
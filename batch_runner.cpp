@@ -0,0 +1,435 @@
+#include "batch_runner.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <thread>
+
+namespace {
+
+// records read ahead of the oldest unwritten one, per worker
+const size_t WINDOW_PER_THREAD = 256;
+// bases read ahead of the oldest unwritten record (their profiles are kept
+// until it is written)
+const size_t WINDOW_BASES = 1 << 22;
+
+// beam used when a record over budget was folded with an unlimited beam
+const int FALLBACK_BEAM = 100;
+// smallest beam tried under the budgets
+const int MIN_BEAM = 10;
+
+// prior footprint estimate: bytes per position and beam state (all 12 alpha
+// and beta tables full, with hash buckets; measured 430-640), and per position
+const double STATE_BYTES = 640;
+const double POSITION_BYTES = 1024;
+// weight of a new measurement when the learned scale goes down
+const double SCALE_DECAY = 0.25;
+
+} // namespace
+
+
+BatchRunner::BatchRunner(int threads, int fold_threads, int beam_size, const energy::Params &params, bool output_energy)
+	: beam_size(beam_size), output_energy(output_energy){
+	if(threads <= 0) threads = max(1u, thread::hardware_concurrency());
+	workers.resize(threads);
+	for(Worker &worker : workers){
+		worker.engine = make_unique<LinCapR>(beam_size, params);
+		worker.engine->set_threads(fold_threads);
+	}
+}
+
+
+// relative folding time of a record: each position keeps up to beam_size
+// states, and pairs with up to beam_size of them
+double BatchRunner::cost(const size_t length) const{
+	const double width = (beam_size > 0 ? min<double>(length, beam_size) : length);
+	return length * width * width + 1;
+}
+
+
+void BatchRunner::set_max_memory(const size_t bytes){
+	max_memory = bytes;
+}
+
+
+void BatchRunner::set_budget(const double seconds, const size_t states){
+	time_budget = seconds;
+	state_budget = states;
+}
+
+
+void BatchRunner::set_dedup_memory(const size_t bytes){
+	dedup_memory = bytes;
+}
+
+
+void BatchRunner::set_window(const size_t window, const size_t overlap){
+	window_size = window;
+	window_overlap = overlap;
+}
+
+
+bool BatchRunner::set_spill_dir(const string &dir){
+	for(Worker &worker : workers){
+		if(!worker.engine->set_spill_dir(dir)) return false;
+	}
+	return true;
+}
+
+
+void BatchRunner::set_checkpoint_interval(const int positions){
+	for(Worker &worker : workers) worker.engine->set_checkpoint_interval(positions);
+}
+
+
+void BatchRunner::set_energy_only(const bool energy_only){
+	this->energy_only = energy_only;
+	for(Worker &worker : workers) worker.engine->set_energy_only(energy_only);
+}
+
+
+void BatchRunner::set_cache(ResultCache *cache){
+	this->cache = cache;
+}
+
+
+// peak bytes of a fold before correction, see STATE_BYTES
+double BatchRunner::prior_memory(const size_t length) const{
+	const double width = (beam_size > 0 ? min<double>(length, beam_size) : length);
+	return length * (width * STATE_BYTES + POSITION_BYTES);
+}
+
+
+// whether task may start now; call with mtx held
+bool BatchRunner::fits(const Task &task) const{
+	if(max_memory == 0 || n_running == 0) return true;
+	return memory_in_use + prior_memory(task.seq.size()) * memory_scale <= max_memory;
+}
+
+
+void BatchRunner::run(FileReader &fr, ProfileWriter &writer){
+	string_view name, seq;
+
+	// one thread: fold in place, straight from the reader's views
+	if(workers.size() == 1){
+		Result result;
+		while(fr.next(name, seq)){
+			if(!find_kept(seq, result)){
+				if(window_size > 0 && seq.size() > window_size){
+					fold_windows(*workers[0].engine, name, seq, result);
+				}else{
+					fold(*workers[0].engine, name, seq, result);
+				}
+				keep(seq, result);
+			}
+			result.profile.name = name;
+			result.profile.number = fr.record_number();
+			emit(writer, result);
+		}
+		return;
+	}
+
+	reading_done = false;
+	vector<thread> threads;
+	for(size_t w = 0; w < workers.size(); w++) threads.emplace_back(&BatchRunner::work, this, w);
+
+	// read records while the window has room, write finished ones in order
+	const size_t window = WINDOW_PER_THREAD * workers.size();
+	size_t n_read = 0, n_written = 0, window_bases = 0;
+	bool input_done = false;
+	vector<Task> batch;
+	vector<size_t> lengths(window);
+	unique_lock<mutex> lock(mtx);
+	while(!reading_done || n_written < n_read){
+		auto it = results.find(n_written);
+		if(it != results.end()){
+			Result result = move(it->second);
+			results.erase(it);
+			lock.unlock();
+			share(n_written, result);
+			emit(writer, result);
+			lock.lock();
+			window_bases -= lengths[n_written % window];
+			n_written++;
+			continue;
+		}
+
+		if(!input_done && n_read - n_written < window && (n_read == n_written || window_bases < WINDOW_BASES)){
+			lock.unlock();
+			Result repeat;
+			bool repeated = false;
+			if(fr.next(name, seq)){
+				auto first = (dedup_memory > 0 ? pending_index.find(seq) : pending_index.end());
+				if(first != pending_index.end()){
+					// wait for the profile of the first record with seq
+					pending[first->second].repeats.push_back({n_read, fr.record_number(), string(name)});
+				}else if(find_kept(seq, repeat)){
+					repeat.profile.name = name;
+					repeat.profile.number = fr.record_number();
+					repeated = true;
+				}else{
+					if(window_size > 0 && seq.size() > window_size){
+						// one task per window, stitched when the last one is folded
+						auto tiled = make_shared<Tiled>(seq.size(), window_size, window_overlap, name, fr.record_number(), beam_size);
+						for(size_t k = 0; k < tiled->tiling.n_windows(); k++){
+							const size_t start = tiled->tiling.window_start(k), end = tiled->tiling.window_end(k);
+							batch.push_back({n_read, fr.record_number(), string(name), string(seq.substr(start, end - start)), cost(end - start), 0, tiled, k});
+						}
+					}else{
+						batch.push_back({n_read, fr.record_number(), string(name), string(seq), cost(seq.size()), 0, nullptr, 0});
+					}
+					// shared when written, stitched or not, as in the one-thread loop
+					if(dedup_memory > 0){
+						Pending &first_record = pending[n_read];
+						first_record.seq = seq;
+						pending_index[first_record.seq] = n_read;
+					}
+				}
+				lengths[n_read % window] = seq.size();
+				window_bases += seq.size();
+				n_read++;
+			}else{
+				input_done = true;
+			}
+			lock.lock();
+			if(repeated) results.emplace(n_read - 1, move(repeat));
+			continue;
+		}
+
+		// the window is full or the input has ended: schedule what was read
+		if(!batch.empty()){
+			dispatch(batch);
+			batch.clear();
+		}
+		if(input_done && !reading_done){
+			reading_done = true;
+			task_ready.notify_all();
+			continue;
+		}
+
+		result_ready.wait(lock);
+	}
+	lock.unlock();
+
+	for(thread &t : threads) t.join();
+}
+
+
+// deal out records, most expensive first, each to the least loaded worker;
+// every deque stays sorted by decreasing cost
+void BatchRunner::dispatch(vector<Task> &batch){
+	stable_sort(batch.begin(), batch.end(), [](const Task &a, const Task &b){ return a.cost > b.cost; });
+	for(Task &task : batch){
+		Worker &worker = *min_element(workers.begin(), workers.end(),
+			[](const Worker &a, const Worker &b){ return a.load < b.load; });
+		worker.load += task.cost;
+		auto pos = upper_bound(worker.tasks.begin(), worker.tasks.end(), task.cost,
+			[](const double cost, const Task &t){ return cost > t.cost; });
+		worker.tasks.insert(pos, move(task));
+		n_queued++;
+	}
+	task_ready.notify_all();
+}
+
+
+// next record for worker w that fits the memory budget: the most expensive
+// one of its own, otherwise the cheapest one of the most loaded worker; call
+// with mtx held
+bool BatchRunner::take(const int w, Task &task){
+	Worker &own = workers[w];
+	auto pick = own.tasks.end();
+	for(auto it = own.tasks.begin(); it != own.tasks.end(); it++){
+		if(fits(*it)){
+			pick = it;
+			break;
+		}
+	}
+
+	Worker *victim = &own;
+	if(pick == own.tasks.end()){
+		// the cheapest queued record of a worker fits whenever any of its records do
+		victim = nullptr;
+		for(Worker &worker : workers){
+			if(&worker == &own || worker.tasks.empty() || !fits(worker.tasks.back())) continue;
+			if(!victim || worker.load > victim->load) victim = &worker;
+		}
+		if(!victim) return false;
+		pick = prev(victim->tasks.end());
+	}
+
+	task = move(*pick);
+	victim->tasks.erase(pick);
+	victim->load = max(0.0, victim->load - task.cost);
+	n_queued--;
+	if(max_memory > 0){
+		task.memory = prior_memory(task.seq.size()) * memory_scale;
+		memory_in_use += task.memory;
+	}
+	n_running++;
+	return true;
+}
+
+
+// worker: fold queued records until the input is exhausted
+void BatchRunner::work(const int w){
+	LinCapR &engine = *workers[w].engine;
+	unique_lock<mutex> lock(mtx);
+	while(true){
+		Task task;
+		if(!take(w, task)){
+			if(reading_done && n_queued == 0) return;
+			// nothing queued, or nothing that fits until a running fold ends
+			task_ready.wait(lock);
+			continue;
+		}
+		lock.unlock();
+
+		Result result;
+		fold(engine, task.name, task.seq, result);
+		result.profile.number = task.number;
+		bool stitched = false;
+		if(task.tiled){
+			lock.lock();
+			add_window_beam(*task.tiled, result.beam);
+			lock.unlock();
+			stitched = task.tiled->tiling.add(task.window, result.profile);
+		}
+
+		lock.lock();
+		n_running--;
+		if(max_memory > 0){
+			memory_in_use -= task.memory;
+			if(result.memory > 0) learn_memory(task.seq.size(), result.memory);
+			task_ready.notify_all();
+		}
+		if(task.tiled){
+			if(!stitched) continue;
+			finish_tiled(*task.tiled, result);
+		}
+		results.emplace(task.index, move(result));
+		result_ready.notify_one();
+	}
+}
+
+
+// update the scale from the measured peak of a finished fold: at once up to a
+// larger ratio, slowly down to a smaller one; call with mtx held
+void BatchRunner::learn_memory(const size_t length, const size_t measured){
+	const double ratio = measured / prior_memory(length);
+	memory_scale = (ratio > memory_scale ? ratio : memory_scale + SCALE_DECAY * (ratio - memory_scale));
+}
+
+
+// copy the kept profile of seq into result (name and number not set)
+bool BatchRunner::find_kept(string_view seq, Result &result){
+	auto it = kept_index.find(seq);
+	if(it == kept_index.end()) return false;
+	kept.splice(kept.begin(), kept, it->second);
+	result = it->second->result;
+	return true;
+}
+
+
+// keep the profile of seq for later repeats, within dedup_memory
+void BatchRunner::keep(string_view seq, const Result &result){
+	const size_t bytes = seq.size() * (NPROBS * sizeof(Float) + 1);
+	if(bytes > dedup_memory || kept_index.count(seq)) return;
+	kept.push_front({string(seq), result});
+	kept_index[kept.front().seq] = kept.begin();
+	kept_bytes += bytes;
+	while(kept_bytes > dedup_memory){
+		const Kept &last = kept.back();
+		kept_bytes -= last.seq.size() * (NPROBS * sizeof(Float) + 1);
+		kept_index.erase(last.seq);
+		kept.pop_back();
+	}
+}
+
+
+// the record at index is about to be written: hand its profile to the
+// repeats of its sequence read so far, and keep it for later ones
+void BatchRunner::share(const size_t index, const Result &result){
+	auto it = pending.find(index);
+	if(it == pending.end()) return;
+	Pending &first_record = it->second;
+	for(Repeat &repeat : first_record.repeats){
+		Result copy = result;
+		copy.profile.name = move(repeat.name);
+		copy.profile.number = repeat.number;
+		lock_guard<mutex> lock(mtx);
+		results.emplace(repeat.index, move(copy));
+	}
+	keep(first_record.seq, result);
+	pending_index.erase(first_record.seq);
+	pending.erase(it);
+}
+
+
+void BatchRunner::fold(LinCapR &engine, string_view name, string_view seq, Result &result) const{
+	result.profile.length = seq.size();
+	int beam = beam_size;
+	if(cache && !energy_only && cache->find(seq, result.profile, result.energy, beam)){
+		result.memory = 0;
+		result.profile.name = name;
+		result.beam = beam;
+		return;
+	}
+
+	engine.set_beam_size(beam_size);
+	engine.set_budget(time_budget, state_budget);
+	while(!engine.run(seq)){
+		engine.clear();
+		if(beam > 0 && beam / 2 < MIN_BEAM){
+			// last try: the smallest beam, without budgets
+			beam = min(beam, MIN_BEAM);
+			engine.set_budget(0, 0);
+		}else{
+			beam = (beam == 0 ? FALLBACK_BEAM : beam / 2);
+		}
+		engine.set_beam_size(beam);
+	}
+	result.memory = engine.memory_usage();
+	engine.get_profile(result.profile, name);
+	result.beam = beam;
+	result.energy = engine.get_energy_ensemble();
+	engine.clear();
+	if(cache && !energy_only) cache->store(seq, result.profile, result.energy, beam);
+}
+
+
+// fold seq as windows of window_size bases, one after the other
+void BatchRunner::fold_windows(LinCapR &engine, string_view name, string_view seq, Result &result) const{
+	Tiled tiled(seq.size(), window_size, window_overlap, name, 0, beam_size);
+	for(size_t k = 0; k < tiled.tiling.n_windows(); k++){
+		const size_t start = tiled.tiling.window_start(k), end = tiled.tiling.window_end(k);
+		fold(engine, name, seq.substr(start, end - start), result);
+		add_window_beam(tiled, result.beam);
+		tiled.tiling.add(k, result.profile);
+	}
+	finish_tiled(tiled, result);
+}
+
+
+// note the beam a window of tiled was folded with
+void BatchRunner::add_window_beam(Tiled &tiled, const int beam) const{
+	if(beam != beam_size) tiled.beam = (tiled.beam == beam_size ? beam : min(tiled.beam, beam));
+}
+
+
+// the stitched record; the ensemble energy of a tiled record is not defined
+void BatchRunner::finish_tiled(Tiled &tiled, Result &result) const{
+	tiled.tiling.take(result.profile);
+	result.profile.name = tiled.name;
+	result.profile.number = tiled.number;
+	result.energy = numeric_limits<Float>::quiet_NaN();
+	result.beam = tiled.beam;
+	result.memory = 0;
+}
+
+
+void BatchRunner::emit(ProfileWriter &writer, Result &result) const{
+	if(result.beam != beam_size) result.profile.name += PROFILE_BEAM_TAG + to_string(result.beam);
+	result.profile.energy = result.energy;
+	writer.write(move(result.profile));
+	if(output_energy) printf("G_ensemble: %.2lf\n", result.energy);
+}
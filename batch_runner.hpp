@@ -0,0 +1,202 @@
+/*
+ * Folding a batch of FASTA records on several threads (--threads).
+ *
+ * Each worker owns a LinCapR engine and a deque of records. Records read
+ * ahead are dealt out longest (most expensive) first to the least loaded
+ * worker; a worker whose deque runs dry steals the cheapest record of the most
+ * loaded one. Finished profiles wait in a reorder buffer and are passed to the
+ * writer in input order, so the output does not depend on the number of
+ * threads or on the schedule.
+ *
+ * With a memory budget (--max-memory), a record is started only while the
+ * estimated footprints of the running folds, its own included, fit in the
+ * budget. The estimate grows with length times beam width, and is scaled by
+ * the ratio of measured to estimated footprint learned from finished records.
+ *
+ * With per-record budgets, a fold that runs out of time or states is
+ * abandoned and repeated with half the beam (an unlimited beam drops to
+ * FALLBACK_BEAM). Below MIN_BEAM the budgets are lifted, so every record
+ * still gets a profile.
+ *
+ * With a result cache (--cache), a record found there is not folded, and
+ * every folded record is stored.
+ *
+ * With a dedup memory limit (--dedup-memory, off by default), records
+ * repeating the sequence of an earlier record are not folded again: a repeat
+ * of a record still being folded waits for its profile, and the profiles of
+ * recently written records are kept, least recently used first out, up to
+ * the limit.
+ *
+ * With a window size (--window), longer records are folded as overlapping
+ * windows, scheduled like separate records, and stitched (window_tiling.hpp).
+ *
+ * With a spill directory (--spill-dir), each engine keeps the inside cells of
+ * long records in a scratch file there (frozen_table.hpp).
+ *
+ * With a checkpoint interval (--checkpoint), each engine keeps part of the
+ * inside cells only at checkpoints (see LinCapR::set_checkpoint_interval).
+ *
+ * With --energy-only, the engines run the inside pass only and the records
+ * written have no probabilities (ProfileFormat::Energy); the cache is
+ * neither read nor written.
+ */
+#pragma once
+
+#include "LinCapR.hpp"
+#include "FileReader.hpp"
+#include "profile_writer.hpp"
+#include "result_cache.hpp"
+#include "window_tiling.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class BatchRunner{
+public:
+	// threads: number of workers (0: all cores), each folding on fold_threads threads
+	BatchRunner(int threads, int fold_threads, int beam_size, const energy::Params &params, bool output_energy);
+
+	// start records only while their estimated DP footprints sum to at most
+	// bytes (0: no limit); a record that alone exceeds it runs by itself
+	void set_max_memory(size_t bytes);
+
+	// per-record budgets (see LinCapR::set_budget): a record over budget is
+	// folded again with half the beam, and its name notes the beam used
+	void set_budget(double seconds, size_t states);
+
+	// look records up in cache before folding them, and store the new ones
+	void set_cache(ResultCache *cache);
+
+	// keep up to bytes of profiles of written records for later repeats of
+	// their sequences (0: fold every record)
+	void set_dedup_memory(size_t bytes);
+
+	// fold records longer than window bases as windows overlapping by overlap
+	// bases (at most window / 2); 0: fold every record whole
+	void set_window(size_t window, size_t overlap);
+
+	// spill the inside cells of long records to scratch files in dir, one
+	// per engine; false if they cannot be created
+	bool set_spill_dir(const string &dir);
+
+	// see LinCapR::set_checkpoint_interval
+	void set_checkpoint_interval(int positions);
+
+	// fold for the ensemble energies only, see LinCapR::set_energy_only
+	void set_energy_only(bool energy_only);
+
+	// fold every record of fr and write the profiles in input order
+	void run(FileReader &fr, ProfileWriter &writer);
+private:
+	struct Result{
+		Profile profile;
+		Float energy;
+		// beam the profile was folded with
+		int beam;
+		// measured peak bytes of the fold (0: taken from the cache)
+		size_t memory;
+	};
+	// a record folded as windows
+	struct Tiled{
+		WindowTiling tiling;
+		string name;
+		size_t number;
+		// smallest beam a window was folded with, if any was downgraded
+		int beam;
+		Tiled(size_t length, size_t window, size_t overlap, string_view name, size_t number, int beam)
+			: tiling(length, window, overlap), name(name), number(number), beam(beam){}
+	};
+	struct Task{
+		size_t index;
+		// input position, see FileReader::record_number()
+		size_t number;
+		string name, seq;
+		double cost;
+		// admitted footprint estimate, released when the fold ends
+		size_t memory = 0;
+		// window of a tiled record
+		shared_ptr<Tiled> tiled;
+		size_t window = 0;
+	};
+	struct Worker{
+		unique_ptr<LinCapR> engine;
+		// queued records, most expensive first
+		deque<Task> tasks;
+		// estimated cost of the queued records
+		double load = 0;
+	};
+
+	const int beam_size;
+	const bool output_energy;
+	double time_budget = 0;
+	size_t state_budget = 0;
+	ResultCache *cache = nullptr;
+	bool energy_only = false;
+	size_t window_size = 0, window_overlap = 0;
+	// engines are created up front: the constructor sets the global logsumexp mode
+	vector<Worker> workers;
+
+	// one lock for all deques: records take milliseconds to hours, so it is
+	// never contended enough to need per-deque locks
+	mutex mtx;
+	condition_variable task_ready, result_ready;
+	size_t n_queued = 0;
+	// reorder buffer: finished records by input index
+	map<size_t, Result> results;
+	bool reading_done = false;
+
+	size_t max_memory = 0;
+	// estimated footprints of the running folds
+	size_t memory_in_use = 0;
+	int n_running = 0;
+	// learned ratio of measured to estimated (prior) footprint
+	double memory_scale = 1;
+
+	// repeated sequences, used by the reading thread only
+	struct Repeat{
+		size_t index, number;
+		string name;
+	};
+	struct Pending{
+		string seq;
+		vector<Repeat> repeats;
+	};
+	struct Kept{
+		string seq;
+		Result result;
+	};
+	size_t dedup_memory = 0;
+	// records being folded by first index, by sequence
+	map<size_t, Pending> pending;
+	unordered_map<string_view, size_t> pending_index;
+	// profiles of written records, most recently used first
+	list<Kept> kept;
+	unordered_map<string_view, list<Kept>::iterator> kept_index;
+	size_t kept_bytes = 0;
+
+	double cost(const size_t length) const;
+	double prior_memory(const size_t length) const;
+	bool fits(const Task &task) const;
+	void dispatch(vector<Task> &batch);
+	bool take(const int w, Task &task);
+	void work(const int w);
+	void learn_memory(const size_t length, const size_t measured);
+	bool find_kept(string_view seq, Result &result);
+	void keep(string_view seq, const Result &result);
+	void share(const size_t index, const Result &result);
+	void fold(LinCapR &engine, string_view name, string_view seq, Result &result) const;
+	void fold_windows(LinCapR &engine, string_view name, string_view seq, Result &result) const;
+	void add_window_beam(Tiled &tiled, const int beam) const;
+	void finish_tiled(Tiled &tiled, Result &result) const;
+	void emit(ProfileWriter &writer, Result &result) const;
+};
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Batch-mode scaling benchmark for --threads.
+#
+# Usage: ./bench/batch_scaling.sh [beam_size] [max_threads]
+#
+# Folds the bundled examples and synthetic batches (many short records, and
+# mixed lengths) with 1, 2, 4, ... max_threads threads (default: all cores),
+# reports wall time and speedup, and checks that every output is
+# byte-identical to the single-threaded one.
+
+set -e
+cd "$(dirname "$0")/.."
+
+BEAM=${1:-100}
+MAX_THREADS=${2:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+[ -x ./LinCapR ] || make -s
+
+# random RNA records: synth <n_records> <min_len> <max_len> <seed>
+synth(){
+	awk -v n="$1" -v lo="$2" -v hi="$3" -v seed="$4" 'BEGIN{
+		srand(seed);
+		split("A C G U", base, " ");
+		for(r = 0; r < n; r++){
+			len = lo + int(rand() * (hi - lo + 1));
+			printf(">synth_%d len=%d\n", r, len);
+			s = "";
+			for(i = 0; i < len; i++) s = s base[1 + int(rand() * 4)];
+			print s;
+		}
+	}'
+}
+
+cat test.fa examples/16S_ribosomalRNA.fasta > "$TMP/examples.fa"
+synth 300 70 200 1 > "$TMP/short.fa"
+synth 40 70 2000 2 > "$TMP/mixed.fa"
+
+now(){ date +%s.%N; }
+
+for input in examples short mixed; do
+	records=$(grep -c '>' "$TMP/$input.fa")
+	echo "$input.fa: $records records, beam $BEAM"
+	t=1
+	base=""
+	while [ "$t" -le "$MAX_THREADS" ]; do
+		start=$(now)
+		./LinCapR "$TMP/$input.fa" "$TMP/$input.$t.out" "$BEAM" --threads "$t" > /dev/null
+		end=$(now)
+		elapsed=$(echo "$start $end" | awk '{printf("%.2f", $2 - $1)}')
+		[ -n "$base" ] || base=$elapsed
+		if cmp -s "$TMP/$input.1.out" "$TMP/$input.$t.out"; then same=identical; else same=DIFFERENT; fi
+		echo "$base $elapsed" | awk -v t="$t" -v same="$same" '{printf("  threads %3d  %8.2f s  speedup %5.2fx  output %s\n", t, $2, $1 / $2, same)}'
+		[ "$t" -lt "$MAX_THREADS" ] && [ $((t * 2)) -gt "$MAX_THREADS" ] && t=$MAX_THREADS || t=$((t * 2))
+	done
+done
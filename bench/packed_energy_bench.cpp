@@ -0,0 +1,173 @@
+/*
+ * Interior-loop table lookup benchmark: int tables (energy::Params) vs the
+ * packed int16 tables (energy::PackedLoopTables).
+ *
+ * Usage: ./bench/packed_energy_bench [seq_len] [rounds]
+ *
+ * Replays the (i, j, p, q) access pattern of the SE -> S expansion in
+ * LinCapR::calc_inside over a random sequence. On Linux, L1D and LLC read
+ * misses are taken from perf_event_open; if the counters are unavailable
+ * (e.g. kernel.perf_event_paranoid), only the timings are reported.
+ * perf has no generic L2 cache event, so LLC misses are reported instead.
+ */
+#include "energy_model.hpp"
+#include "packed_energy.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// cache miss counter, no-op where perf events are unavailable
+struct MissCounter{
+	int fd = -1;
+
+	// counts L1D read misses, or last-level cache read misses if last_level
+	explicit MissCounter(const bool last_level){
+#ifdef __linux__
+		const unsigned long long cache = (last_level ? PERF_COUNT_HW_CACHE_LL : PERF_COUNT_HW_CACHE_L1D);
+		perf_event_attr attr{};
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.size = sizeof(attr);
+		attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+	~MissCounter(){
+#ifdef __linux__
+		if(fd >= 0) close(fd);
+#endif
+	}
+
+	void start(){
+#ifdef __linux__
+		if(fd < 0) return;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	long long stop(){
+#ifdef __linux__
+		if(fd < 0) return -1;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		long long count = 0;
+		if(read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+		return count;
+#else
+		return -1;
+#endif
+	}
+};
+
+struct Query{
+	int type1, type2, si, sj, sp, sq, d1, d2;
+};
+
+// same branches as LinCapR::energy_loop for internal loops (d1, d2 >= 1)
+inline int lookup_int(const energy::Params &params, const Query &x){
+	const int dmin = min(x.d1, x.d2), dmax = max(x.d1, x.d2), d = x.d1 + x.d2;
+	if(x.d1 == 1 && x.d2 == 1) return (*params.int11_37)[x.type1][x.type2][x.si][x.sj];
+	if(x.d1 == 1 && x.d2 == 2) return (*params.int21_37)[x.type1][x.type2][x.si][x.sq][x.sj];
+	if(x.d1 == 2 && x.d2 == 1) return (*params.int21_37)[x.type2][x.type1][x.sq][x.si][x.sp];
+	if(x.d1 == 2 && x.d2 == 2) return (*params.int22_37)[x.type1][x.type2][x.si][x.sp][x.sq][x.sj];
+	int energy = params.internal_loop37[d] + min(params.MAX_NINIO, params.ninio37 * (dmax - dmin));
+	if(dmin == 1) return energy + params.mismatch1nI37[x.type1][x.si][x.sj] + params.mismatch1nI37[x.type2][x.sq][x.sp];
+	if(dmin == 2 && dmax == 3) return energy + params.mismatch23I37[x.type1][x.si][x.sj] + params.mismatch23I37[x.type2][x.sq][x.sp];
+	return energy + params.mismatchI37[x.type1][x.si][x.sj] + params.mismatchI37[x.type2][x.sq][x.sp];
+}
+
+inline int lookup_packed(const energy::Params &params, const energy::PackedLoopTables &t, const Query &x){
+	using energy::unpack;
+	const int a = x.type1 - 1, b = x.type2 - 1;
+	const int dmin = min(x.d1, x.d2), dmax = max(x.d1, x.d2), d = x.d1 + x.d2;
+	if(x.d1 == 1 && x.d2 == 1) return unpack(t.int11[a][b][x.si][x.sj]);
+	if(x.d1 == 1 && x.d2 == 2) return unpack(t.int21[a][b][x.si][x.sq][x.sj]);
+	if(x.d1 == 2 && x.d2 == 1) return unpack(t.int21[b][a][x.sq][x.si][x.sp]);
+	if(x.d1 == 2 && x.d2 == 2) return unpack(t.int22[a][b][x.si][x.sp][x.sq][x.sj]);
+	int energy = unpack(t.internal_loop[d]) + min(params.MAX_NINIO, params.ninio37 * (dmax - dmin));
+	if(dmin == 1) return energy + unpack(t.mismatch1nI[a][x.si][x.sj]) + unpack(t.mismatch1nI[b][x.sq][x.sp]);
+	if(dmin == 2 && dmax == 3) return energy + unpack(t.mismatch23I[a][x.si][x.sj]) + unpack(t.mismatch23I[b][x.sq][x.sp]);
+	return energy + unpack(t.mismatchI[a][x.si][x.sj]) + unpack(t.mismatchI[b][x.sq][x.sp]);
+}
+
+// internal loops p..i..j..q as enumerated by the SE -> S expansion
+vector<Query> make_queries(const int n, mt19937 &rng){
+	vector<int> s(n);
+	for(int &c : s) c = rng() % 4 + 1;
+
+	vector<Query> queries;
+	for(int j = MAXLOOP; j + MAXLOOP + 1 < n; j++){
+		const int i = j - TURN - 1 - (int)(rng() % 8);
+		if(i <= MAXLOOP || BP_pair[s[i]][s[j]] == 0) continue;
+		for(int p = i - 1; i - p <= MAXLOOP; p--){
+			for(int q = j + 1; (q - j - 1) + (i - p) <= MAXLOOP; q++){
+				const int d1 = i - p - 1, d2 = q - j - 1;
+				if(d1 == 0 || d2 == 0 || BP_pair[s[p]][s[q]] == 0) continue;
+				queries.push_back({BP_pair[s[p]][s[q]], BP_pair[s[j]][s[i]], s[p + 1], s[q - 1], s[i - 1], s[j + 1], d1, d2});
+			}
+		}
+	}
+	shuffle(queries.begin(), queries.end(), rng);
+	return queries;
+}
+
+template<class F>
+void measure(const char *label, const vector<Query> &queries, const int rounds, F lookup){
+	MissCounter l1(false), llc(true);
+
+	long long sum = 0;
+	l1.start();
+	llc.start();
+	const auto begin = chrono::steady_clock::now();
+	for(int r = 0; r < rounds; r++){
+		for(const Query &x : queries) sum += lookup(x);
+	}
+	const double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count();
+	const long long l1_miss = l1.stop(), llc_miss = llc.stop();
+
+	const double lookups = (double)queries.size() * rounds;
+	printf("%-8s %8.2f ns/lookup", label, ns / lookups);
+	if(l1_miss >= 0) printf("  L1D miss/lookup %.4f", l1_miss / lookups);
+	else printf("  L1D miss/lookup n/a");
+	if(llc_miss >= 0) printf("  LLC miss/lookup %.4f", llc_miss / lookups);
+	else printf("  LLC miss/lookup n/a");
+	printf("  (checksum %lld)\n", sum);
+}
+
+int main(int argc, char **argv){
+	const int n = (argc > 1 ? atoi(argv[1]) : 20000);
+	const int rounds = (argc > 2 ? atoi(argv[2]) : 5);
+
+	printf("cache misses: L1D and last-level (no generic L2 event in perf)\n");
+
+	mt19937 rng(12345);
+	const vector<Query> queries = make_queries(n, rng);
+
+	for(const auto model : {energy::Model::Turner2004, energy::Model::Turner1999}){
+		const energy::Params &params = energy::get_params(model);
+		const energy::PackedLoopTables packed = energy::pack_loop_tables(params);
+
+		const size_t int_bytes = sizeof(*params.int11_37) + sizeof(*params.int21_37) + sizeof(*params.int22_37)
+			+ 3 * sizeof(int[NBPAIRS + 1][5][5]);
+		printf("%s: %zu queries, int tables %zu bytes, packed tables %zu bytes\n",
+		       model == energy::Model::Turner2004 ? "turner2004" : "turner1999",
+		       queries.size(), int_bytes, sizeof(packed));
+
+		measure("int", queries, rounds, [&](const Query &x){ return lookup_int(params, x); });
+		measure("packed", queries, rounds, [&](const Query &x){ return lookup_packed(params, packed, x); });
+	}
+	return 0;
+}
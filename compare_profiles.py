@@ -5,9 +5,9 @@ Compare LinearCapR output profiles.
 Usage:
     ./compare_profiles.py file_a file_b
 
-The script parses the profile text files produced by LinearCapR (lines beginning
-with profile labels such as "Bulge", "Hairpin", etc.), aligns sequences by their
-headers, and reports statistics for each profile type:
+The script parses the profile files produced by LinearCapR (text files with
+lines beginning with profile labels such as "Bulge", "Hairpin", etc., or
+`--format binary` files), aligns sequences by their headers, and reports statistics for each profile type:
     * maximum absolute difference
     * mean absolute difference
     * RMS difference
@@ -21,15 +21,70 @@ it returns 1.
 from __future__ import annotations
 
 import argparse
+import array
 import math
+import struct
+import sys
 from pathlib import Path
 from typing import Dict, List, Tuple
 
 ProfileMap = Dict[str, Dict[str, List[float]]]
 
+LABELS = ("Bulge", "Exterior", "Hairpin", "Internal", "Multiloop", "Stem")
+# label suffix of `--quantize` text output, whose values are q / 255
+Q8_LABEL_SUFFIX = "/255"
+# appended to the names of records folded with a downgraded beam
+BEAM_TAG = "\tbeam="
+
+
+def record_name(header: str) -> str:
+    """Record name without the beam annotation, so downgraded records still pair up."""
+    tag = header.rfind(BEAM_TAG)
+    return header if tag < 0 else header[:tag]
+BINARY_MAGIC = b"LCRPROF\0"
+
+
+def parse_binary_profile(path: Path) -> ProfileMap:
+    """Parse a `--format binary` file (see profile_file.hpp)."""
+    data = path.read_bytes()
+    _, version, encoding, n_records, table_offset, names_offset, file_size = struct.unpack_from("<8sIIQQQQ", data)
+    if version != 1 or encoding not in (0, 1, 2):
+        raise ValueError(f"Unsupported binary profile version/encoding in {path}")
+    if file_size != len(data):
+        raise ValueError(f"Binary profile file is truncated or incomplete: {path}")
+
+    profiles: ProfileMap = {}
+    for i in range(n_records):
+        data_offset, length, name_offset, name_length = struct.unpack_from("<QQQQ", data, table_offset + 32 * i)
+        name = record_name(data[names_offset + name_offset:names_offset + name_offset + name_length].decode())
+        if encoding == 0:
+            values = array.array("f", data[data_offset:data_offset + 4 * len(LABELS) * length])
+            if sys.byteorder != "little":
+                values.byteswap()
+            columns = [values[k * length:(k + 1) * length].tolist() for k in range(len(LABELS))]
+        elif encoding == 1:
+            columns = [[q / 255 for q in data[data_offset + k * length:data_offset + (k + 1) * length]] for k in range(len(LABELS))]
+        else:
+            # per position: mask of non-zero contexts, then their values
+            columns = [[0.0] * length for _ in LABELS]
+            pos = data_offset
+            for t in range(length):
+                mask = data[pos]
+                pos += 1
+                for k in range(len(LABELS)):
+                    if mask >> k & 1:
+                        columns[k][t] = data[pos] / 255
+                        pos += 1
+        profiles[name] = dict(zip(LABELS, columns))
+    return profiles
+
 
 def parse_profile(path: Path) -> ProfileMap:
     """Parse a LinearCapR output file into a nested dict."""
+    with path.open("rb") as fh:
+        if fh.read(len(BINARY_MAGIC)) == BINARY_MAGIC:
+            return parse_binary_profile(path)
+
     current_seq: str | None = None
     profiles: ProfileMap = {}
 
@@ -39,14 +94,18 @@ def parse_profile(path: Path) -> ProfileMap:
             if not line:
                 continue
             if line.startswith(">"):
-                current_seq = line[1:]
+                current_seq = record_name(line[1:])
                 profiles[current_seq] = {}
                 continue
             if current_seq is None:
                 raise ValueError(f"Encountered data before sequence header in {path}: {line}")
             label, *values = line.split()
+            scale = 1.0
+            if label.endswith(Q8_LABEL_SUFFIX):
+                label = label[:-len(Q8_LABEL_SUFFIX)]
+                scale = 255.0
             try:
-                profiles[current_seq][label] = [float(v) for v in values]
+                profiles[current_seq][label] = [float(v) / scale for v in values]
             except ValueError as exc:
                 raise ValueError(f"Failed to parse floats for {label} in {path}") from exc
     return profiles
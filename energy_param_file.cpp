@@ -0,0 +1,385 @@
+#include "energy_param_file.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace energy {
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'L', 'C', 'R', 'P', 'A', 'R', 'M', 0};
+const uint32_t CACHE_VERSION = 1;
+
+// binary cache layout: CacheHeader followed by the raw ParamTables
+struct CacheHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t table_size;
+	uint64_t source_size;
+	int64_t source_mtime;
+};
+
+// identifies the .par file a cache was built from
+bool source_stamp(const string &par_file, uint64_t &size, int64_t &mtime){
+	error_code ec;
+	size = filesystem::file_size(par_file, ec);
+	if(ec) return false;
+	mtime = filesystem::last_write_time(par_file, ec).time_since_epoch().count();
+	return !ec;
+}
+
+// returns the value of a token in a .par file
+bool parse_value(const string &token, double &value){
+	if(token == "INF"){
+		value = INF;
+		return true;
+	}
+	if(token == "DEF"){
+		value = -50;
+		return true;
+	}
+	char *end = nullptr;
+	value = strtod(token.c_str(), &end);
+	return end != token.c_str() && *end == '\0';
+}
+
+// copy values into the sub-block [lo, hi) of a row-major array with extents dims
+bool assign(int *array, const vector<int> &dims, const vector<int> &lo, const vector<int> &hi, const vector<double> &values){
+	size_t count = 1;
+	for(size_t k = 0; k < dims.size(); k++) count *= hi[k] - lo[k];
+	if(values.size() != count) return false;
+
+	vector<int> index(lo);
+	for(const double value : values){
+		size_t offset = 0;
+		for(size_t k = 0; k < dims.size(); k++) offset = offset * dims[k] + index[k];
+		array[offset] = (int)value;
+
+		// advance the multi-index, last dimension fastest
+		for(int k = dims.size() - 1; k >= 0; k--){
+			if(++index[k] < hi[k]) break;
+			index[k] = lo[k];
+		}
+	}
+	return true;
+}
+
+// special hairpin lines "<loop> <energy> <enthalpy>"
+bool assign_loops(char *loops, const size_t loops_size, int *energies, const vector<string> &lines){
+	string joined;
+	int n = 0;
+	for(const string &line : lines){
+		istringstream iss(line);
+		string loop, energy;
+		if(!(iss >> loop)) continue;
+		double value;
+		if(!(iss >> energy) || !parse_value(energy, value) || n >= 40) return false;
+		joined += loop + " ";
+		energies[n++] = (int)value;
+	}
+	if(joined.size() >= loops_size) return false;
+
+	memset(loops, 0, loops_size);
+	memcpy(loops, joined.c_str(), joined.size());
+	for(int i = n; i < 40; i++) energies[i] = 0;
+	return true;
+}
+
+// Turner 2004 values, used for sections a .par file does not set
+void set_defaults(ParamTables &t){
+	namespace d = turner2004;
+	t.lxc37 = d::lxc37;
+	t.ML_intern37 = d::ML_intern37;
+	t.ML_closing37 = d::ML_closing37;
+	t.ML_BASE37 = d::ML_BASE37;
+	t.MAX_NINIO = d::MAX_NINIO;
+	t.ninio37 = d::ninio37;
+	t.TerminalAU37 = d::TerminalAU37;
+	memcpy(t.stack37, d::stack37, sizeof(t.stack37));
+	memcpy(t.hairpin37, d::hairpin37, sizeof(t.hairpin37));
+	memcpy(t.bulge37, d::bulge37, sizeof(t.bulge37));
+	memcpy(t.internal_loop37, d::internal_loop37, sizeof(t.internal_loop37));
+	memcpy(t.mismatchI37, d::mismatchI37, sizeof(t.mismatchI37));
+	memcpy(t.mismatch1nI37, d::mismatch1nI37, sizeof(t.mismatch1nI37));
+	memcpy(t.mismatch23I37, d::mismatch23I37, sizeof(t.mismatch23I37));
+	memcpy(t.mismatchH37, d::mismatchH37, sizeof(t.mismatchH37));
+	memcpy(t.mismatchM37, d::mismatchM37, sizeof(t.mismatchM37));
+	memcpy(t.mismatchExt37, d::mismatchExt37, sizeof(t.mismatchExt37));
+	memcpy(t.dangle5_37, d::dangle5_37, sizeof(t.dangle5_37));
+	memcpy(t.dangle3_37, d::dangle3_37, sizeof(t.dangle3_37));
+	memcpy(t.int11_37, d::int11_37, sizeof(t.int11_37));
+	memcpy(t.int21_37, d::int21_37, sizeof(t.int21_37));
+	memcpy(t.int22_37, d::int22_37, sizeof(t.int22_37));
+	memcpy(t.Triloops, d::Triloops, sizeof(t.Triloops));
+	memcpy(t.Triloop37, d::Triloop37, sizeof(t.Triloop37));
+	memcpy(t.Tetraloops, d::Tetraloops, sizeof(t.Tetraloops));
+	memcpy(t.Tetraloop37, d::Tetraloop37, sizeof(t.Tetraloop37));
+	memcpy(t.Hexaloops, d::Hexaloops, sizeof(t.Hexaloops));
+	memcpy(t.Hexaloop37, d::Hexaloop37, sizeof(t.Hexaloop37));
+}
+
+} // namespace
+
+
+bool ParamFile::load(const string &par_file){
+	owned = make_unique<ParamTables>();
+	if(!parse(par_file, *owned)) return false;
+	cache.close();
+	bind(*owned);
+	return true;
+}
+
+
+bool ParamFile::load(const string &par_file, const string &cache_file){
+	if(read_cache(cache_file, par_file)) return true;
+	if(par_file.empty()){
+		cout << "Error: invalid parameter cache: " << cache_file << endl;
+		return false;
+	}
+
+	if(!load(par_file)) return false;
+	if(!write_cache(cache_file, par_file)){
+		cout << "Warning: cannot write parameter cache: " << cache_file << endl;
+	}
+	return true;
+}
+
+
+// parse a ViennaRNA v2.0 parameter file into t
+bool ParamFile::parse(const string &par_file, ParamTables &t) const{
+	ifstream ifs(par_file);
+	if(!ifs){
+		cout << "Error: cannot open parameter file: " << par_file << endl;
+		return false;
+	}
+
+	string line;
+	if(!getline(ifs, line) || line.rfind("## RNAfold parameter file v2.0", 0) != 0){
+		cout << "Error: not a ViennaRNA v2.0 parameter file: " << par_file << endl;
+		return false;
+	}
+
+	set_defaults(t);
+
+	// split into sections, dropping /* */ comments
+	vector<pair<string, vector<string>>> sections;
+	bool in_comment = false;
+	while(getline(ifs, line)){
+		string text;
+		for(size_t k = 0; k < line.size(); k++){
+			if(in_comment){
+				if(line.compare(k, 2, "*/") == 0){
+					in_comment = false;
+					k++;
+				}
+			}else if(line.compare(k, 2, "/*") == 0){
+				in_comment = true;
+				k++;
+			}else{
+				text += line[k];
+			}
+		}
+
+		if(text.rfind("# ", 0) == 0){
+			istringstream iss(text.substr(2));
+			string name;
+			iss >> name;
+			if(name == "END") break;
+			sections.push_back({name, {}});
+		}else if(!sections.empty()){
+			sections.back().second.push_back(text);
+		}
+	}
+
+	for(const auto &[name, lines] : sections){
+		vector<double> values;
+		if(name != "Triloops" && name != "Tetraloops" && name != "Hexaloops"){
+			for(const string &body : lines){
+				istringstream iss(body);
+				string token;
+				while(iss >> token){
+					double value;
+					if(!parse_value(token, value)){
+						cout << "Error: invalid value '" << token << "' in section " << name << ": " << par_file << endl;
+						return false;
+					}
+					values.push_back(value);
+				}
+			}
+		}
+
+		bool ok = true;
+		const int P = NBPAIRS + 1;
+		if(name == "stack") ok = assign(&t.stack37[0][0], {P, P}, {1, 1}, {P, P}, values);
+		else if(name == "mismatch_hairpin") ok = assign(&t.mismatchH37[0][0][0], {P, 5, 5}, {1, 0, 0}, {P, 5, 5}, values);
+		else if(name == "mismatch_interior") ok = assign(&t.mismatchI37[0][0][0], {P, 5, 5}, {1, 0, 0}, {P, 5, 5}, values);
+		else if(name == "mismatch_interior_1n") ok = assign(&t.mismatch1nI37[0][0][0], {P, 5, 5}, {1, 0, 0}, {P, 5, 5}, values);
+		else if(name == "mismatch_interior_23") ok = assign(&t.mismatch23I37[0][0][0], {P, 5, 5}, {1, 0, 0}, {P, 5, 5}, values);
+		else if(name == "mismatch_multi") ok = assign(&t.mismatchM37[0][0][0], {P, 5, 5}, {1, 0, 0}, {P, 5, 5}, values);
+		else if(name == "mismatch_exterior") ok = assign(&t.mismatchExt37[0][0][0], {P, 5, 5}, {1, 0, 0}, {P, 5, 5}, values);
+		else if(name == "dangle5") ok = assign(&t.dangle5_37[0][0], {P, 5}, {1, 0}, {P, 5}, values);
+		else if(name == "dangle3") ok = assign(&t.dangle3_37[0][0], {P, 5}, {1, 0}, {P, 5}, values);
+		else if(name == "int11") ok = assign(&t.int11_37[0][0][0][0], {P, P, 5, 5}, {1, 1, 0, 0}, {P, P, 5, 5}, values);
+		else if(name == "int21") ok = assign(&t.int21_37[0][0][0][0][0], {P, P, 5, 5, 5}, {1, 1, 0, 0, 0}, {P, P, 5, 5, 5}, values);
+		else if(name == "int22") ok = assign(&t.int22_37[0][0][0][0][0][0], {P, P, 5, 5, 5, 5}, {1, 1, 1, 1, 1, 1}, {P - 1, P - 1, 5, 5, 5, 5}, values);
+		else if(name == "hairpin") ok = assign(t.hairpin37, {31}, {0}, {31}, values);
+		else if(name == "bulge") ok = assign(t.bulge37, {31}, {0}, {31}, values);
+		else if(name == "interior") ok = assign(t.internal_loop37, {31}, {0}, {31}, values);
+		else if(name == "ML_params"){
+			// cu cu_dH cc cc_dH ci ci_dH
+			ok = values.size() == 6;
+			if(ok){
+				t.ML_BASE37 = values[0];
+				t.ML_closing37 = values[2];
+				t.ML_intern37 = values[4];
+			}
+		}else if(name == "NINIO"){
+			// ninio ninio_dH max_ninio
+			ok = values.size() == 3;
+			if(ok){
+				t.ninio37 = values[0];
+				t.MAX_NINIO = values[2];
+			}
+		}else if(name == "Misc"){
+			// duplex_init duplex_init_dH terminalAU terminalAU_dH [lxc lxc_dH]
+			ok = values.size() >= 4;
+			if(ok){
+				t.TerminalAU37 = values[2];
+				if(values.size() >= 5) t.lxc37 = values[4];
+			}
+		}
+		else if(name == "Triloops") ok = assign_loops(t.Triloops, sizeof(t.Triloops), t.Triloop37, lines);
+		else if(name == "Tetraloops") ok = assign_loops(t.Tetraloops, sizeof(t.Tetraloops), t.Tetraloop37, lines);
+		else if(name == "Hexaloops") ok = assign_loops(t.Hexaloops, sizeof(t.Hexaloops), t.Hexaloop37, lines);
+		// other sections (enthalpies, ...) are not used
+
+		if(!ok){
+			cout << "Error: malformed section " << name << ": " << par_file << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// mmap cache_file and bind to it if it matches par_file
+bool ParamFile::read_cache(const string &cache_file, const string &par_file){
+	owned.reset();
+	cache.close();
+	if(!cache.open(cache_file)) return false;
+
+	CacheHeader header;
+	bool ok = cache.size() == sizeof(CacheHeader) + sizeof(ParamTables);
+	if(ok){
+		memcpy(&header, cache.data(), sizeof(header));
+		ok = memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+			&& header.version == CACHE_VERSION && header.table_size == sizeof(ParamTables);
+	}
+	if(ok && !par_file.empty()){
+		uint64_t size;
+		int64_t mtime;
+		ok = source_stamp(par_file, size, mtime) && header.source_size == size && header.source_mtime == mtime;
+	}
+	if(!ok){
+		cache.close();
+		return false;
+	}
+
+	bind(*(const ParamTables*)(cache.data() + sizeof(CacheHeader)));
+	return true;
+}
+
+
+// dump the loaded tables next to a header identifying par_file
+bool ParamFile::write_cache(const string &cache_file, const string &par_file) const{
+	CacheHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.table_size = sizeof(ParamTables);
+	if(!source_stamp(par_file, header.source_size, header.source_mtime)) return false;
+
+	// write to a temporary file and rename, so concurrent jobs never see a partial
+	// cache; mkstemp keeps the name unique across processes and hosts sharing it
+	string temp_file = cache_file + ".tmpXXXXXX";
+#ifdef _WIN32
+	temp_file = cache_file + ".tmp" + to_string((uintptr_t)this);
+#else
+	const int fd = mkstemp(temp_file.data());
+	if(fd < 0) return false;
+	// readable by other jobs, like a file created by ofstream
+	fchmod(fd, 0644);
+	close(fd);
+#endif
+	{
+		ofstream ofs(temp_file, ios::binary | ios::trunc);
+		if(!ofs) return false;
+		ofs.write((const char*)&header, sizeof(header));
+		ofs.write((const char*)owned.get(), sizeof(ParamTables));
+		if(!ofs){
+			error_code ec;
+			filesystem::remove(temp_file, ec);
+			return false;
+		}
+	}
+
+	error_code ec;
+	filesystem::rename(temp_file, cache_file, ec);
+	if(ec) filesystem::remove(temp_file, ec);
+	return !ec;
+}
+
+
+// point current at the tables in t
+void ParamFile::bind(const ParamTables &t){
+	current = {
+		.temperature = turner2004::temperature,
+		.gas_constant = GASCONST,
+		.k0 = K0,
+		.kT = turner2004::kT,
+		.lxc37 = t.lxc37,
+		.ML_intern37 = t.ML_intern37,
+		.ML_closing37 = t.ML_closing37,
+		.ML_BASE37 = t.ML_BASE37,
+		.MAX_NINIO = t.MAX_NINIO,
+		.ninio37 = t.ninio37,
+		.TerminalAU37 = t.TerminalAU37,
+		.stack37 = t.stack37,
+		.hairpin37 = t.hairpin37,
+		.bulge37 = t.bulge37,
+		.internal_loop37 = t.internal_loop37,
+		.mismatchI37 = t.mismatchI37,
+		.mismatch1nI37 = t.mismatch1nI37,
+		.mismatch23I37 = t.mismatch23I37,
+		.mismatchH37 = t.mismatchH37,
+		.mismatchM37 = t.mismatchM37,
+		.mismatchExt37 = t.mismatchExt37,
+		.dangle5_37 = t.dangle5_37,
+		.dangle3_37 = t.dangle3_37,
+		.int11_37 = &t.int11_37,
+		.int21_37 = &t.int21_37,
+		.int22_37 = &t.int22_37,
+		.Triloops = t.Triloops,
+		.Triloop37 = t.Triloop37,
+		.Tetraloops = t.Tetraloops,
+		.Tetraloop37 = t.Tetraloop37,
+		.Hexaloops = t.Hexaloops,
+		.Hexaloop37 = t.Hexaloop37,
+		.has_special_hairpins = true,
+		.allow_mismatch_multi = true,
+		.allow_mismatch_external = true,
+		.use_fast_logsumexp = true
+	};
+}
+
+} // namespace energy
@@ -0,0 +1,71 @@
+/*
+ * Energy parameters loaded at run time from ViennaRNA-format .par files,
+ * with an optional binary cache that is mmapped on later runs.
+ */
+#pragma once
+
+#include "energy_model.hpp"
+#include "mapped_file.hpp"
+
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace energy {
+
+// storage behind a runtime Params; plain data so the cache is a raw dump of it
+struct ParamTables{
+	double lxc37;
+	int ML_intern37;
+	int ML_closing37;
+	int ML_BASE37;
+	int MAX_NINIO;
+	int ninio37;
+	int TerminalAU37;
+	int stack37[NBPAIRS+1][NBPAIRS+1];
+	int hairpin37[31];
+	int bulge37[31];
+	int internal_loop37[31];
+	int mismatchI37[NBPAIRS+1][5][5];
+	int mismatch1nI37[NBPAIRS+1][5][5];
+	int mismatch23I37[NBPAIRS+1][5][5];
+	int mismatchH37[NBPAIRS+1][5][5];
+	int mismatchM37[NBPAIRS+1][5][5];
+	int mismatchExt37[NBPAIRS+1][5][5];
+	int dangle5_37[NBPAIRS+1][5];
+	int dangle3_37[NBPAIRS+1][5];
+	remove_const_t<Int11Array> int11_37;
+	remove_const_t<Int21Array> int21_37;
+	remove_const_t<Int22Array> int22_37;
+	char Triloops[241];
+	int Triloop37[40];
+	char Tetraloops[281];
+	int Tetraloop37[40];
+	char Hexaloops[361];
+	int Hexaloop37[40];
+};
+
+class ParamFile{
+public:
+	ParamFile(){}
+
+	// parse a .par file; sections missing from the file keep Turner 2004 values
+	bool load(const string &par_file);
+
+	// like load(), but reuse cache_file if it was built from the same par_file,
+	// otherwise parse and (re)write it; an empty par_file loads the cache as is
+	bool load(const string &par_file, const string &cache_file);
+
+	const Params &params() const{ return current; }
+private:
+	unique_ptr<ParamTables> owned;
+	MappedFile cache;
+	Params current;
+
+	bool parse(const string &par_file, ParamTables &t) const;
+	bool read_cache(const string &cache_file, const string &par_file);
+	bool write_cache(const string &cache_file, const string &par_file) const;
+	void bind(const ParamTables &t);
+};
+
+} // namespace energy
@@ -0,0 +1,215 @@
+#include "fasta_index.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// [begin, end) of the line starting at pos, without trailing whitespace; returns the next line
+size_t line_at(const char *data, const size_t size, const size_t pos, size_t &end){
+	const char *nl = (const char*)memchr(data + pos, '\n', size - pos);
+	const size_t next = (nl ? nl - data + 1 : size);
+	end = (nl ? nl - data : size);
+	while(end > pos && isspace((unsigned char)data[end - 1])) end--;
+	return next;
+}
+
+// name as written to .fai: the header up to the first whitespace
+string_view fai_name(string_view header){
+	size_t k = 0;
+	while(k < header.size() && !isspace((unsigned char)header[k])) k++;
+	return header.substr(0, k);
+}
+
+// first record start at or after pos: a '>' at the beginning of a line
+size_t record_start(const char *data, const size_t size, size_t pos){
+	while(pos < size){
+		if(data[pos] == '>' && (pos == 0 || data[pos - 1] == '\n')) return pos;
+		const char *nl = (const char*)memchr(data + pos, '\n', size - pos);
+		if(!nl) return size;
+		pos = nl - data + 1;
+	}
+	return size;
+}
+
+// records whose header starts in [begin, end)
+void scan(const char *data, const size_t size, const size_t begin, const size_t end, vector<FastaRecord> &records){
+	size_t pos = begin;
+	while(pos < end){
+		FastaRecord r{};
+		size_t line_end;
+		size_t next = line_at(data, size, pos, line_end);
+		r.name_offset = pos + 1;
+		r.name_length = line_end - pos - 1;
+		r.seq_offset = next;
+		r.seq_bytes = 0;
+
+		// sequence lines up to the next header; all but the last must have
+		// line_bases bases in line_width bytes
+		bool regular = true;
+		size_t prev_bases = 0, prev_width = 0;
+		pos = next;
+		while(pos < size && data[pos] != '>'){
+			next = line_at(data, size, pos, line_end);
+			const size_t bases = line_end - pos;
+			if(bases == 0){
+				// blank lines are skipped, but break the fixed line layout
+				if(next < size && data[next] != '>') regular = false;
+				pos = next;
+				continue;
+			}
+
+			if(r.n_lines == 0){
+				r.line_bases = bases;
+				r.line_width = next - pos;
+			}else if(prev_bases != r.line_bases || prev_width != r.line_width || bases > r.line_bases){
+				regular = false;
+			}
+			prev_bases = bases;
+			prev_width = next - pos;
+			r.length += bases;
+			r.n_lines++;
+			r.seq_bytes = line_end - r.seq_offset;
+			pos = next;
+		}
+		if(!regular) r.line_bases = r.line_width = 0;
+		records.push_back(r);
+	}
+}
+
+} // namespace
+
+
+void FastaIndex::build(const MappedFile &file, int threads){
+	records.clear();
+	const char *data = file.data();
+	const size_t size = file.size();
+	threads = max(1, threads);
+
+	// split points, each moved to the next record start
+	vector<size_t> bounds(threads + 1, size);
+	bounds[0] = record_start(data, size, 0);
+	for(int t = 1; t < threads; t++){
+		bounds[t] = max(bounds[t - 1], record_start(data, size, size / threads * t));
+	}
+
+	vector<vector<FastaRecord>> parts(threads);
+	vector<thread> workers;
+	for(int t = 1; t < threads; t++){
+		workers.emplace_back(scan, data, size, bounds[t], bounds[t + 1], ref(parts[t]));
+	}
+	scan(data, size, bounds[0], bounds[1], parts[0]);
+	for(thread &worker : workers) worker.join();
+
+	for(const vector<FastaRecord> &part : parts){
+		records.insert(records.end(), part.begin(), part.end());
+	}
+}
+
+
+// read records from a .fai made for file; the full header is recovered
+// from the line before each sequence
+bool FastaIndex::load_fai(const MappedFile &file, const string &fai_file){
+	ifstream ifs(fai_file);
+	if(!ifs) return false;
+
+	vector<FastaRecord> loaded;
+	string line;
+	while(getline(ifs, line)){
+		if(line.empty()) continue;
+		istringstream iss(line);
+		string name;
+		FastaRecord r{};
+		if(!getline(iss, name, '\t') || !(iss >> r.length >> r.seq_offset >> r.line_bases >> r.line_width)) return false;
+		if(r.seq_offset == 0 || r.seq_offset > file.size()) return false;
+		if(r.length > 0 && (r.line_bases == 0 || r.line_width < r.line_bases)) return false;
+
+		// header line ends right before the sequence
+		size_t end = r.seq_offset - 1;
+		if(file.data()[end] != '\n') return false;
+		size_t begin = end;
+		while(begin > 0 && file.data()[begin - 1] != '\n') begin--;
+		while(end > begin && isspace((unsigned char)file.data()[end - 1])) end--;
+		if(file.data()[begin] != '>' || fai_name(string_view(file.data() + begin + 1, end - begin - 1)) != name) return false;
+		r.name_offset = begin + 1;
+		r.name_length = end - begin - 1;
+
+		// byte span of length bases laid out line_bases per line_width bytes
+		if(r.length > 0){
+			r.n_lines = (r.length + r.line_bases - 1) / r.line_bases;
+			r.seq_bytes = (r.n_lines - 1) * r.line_width + (r.length - (r.n_lines - 1) * r.line_bases);
+			if(r.seq_offset + r.seq_bytes > file.size()) return false;
+		}
+		loaded.push_back(r);
+	}
+
+	records = move(loaded);
+	by_name.clear();
+	return true;
+}
+
+
+bool FastaIndex::write_fai(const MappedFile &file, const string &fai_file) const{
+	for(const FastaRecord &r : records){
+		if(r.length > 0 && r.line_bases == 0) return false;
+	}
+
+	ofstream ofs(fai_file, ios::trunc);
+	if(!ofs) return false;
+	for(size_t i = 0; i < records.size(); i++){
+		const FastaRecord &r = records[i];
+		// samtools uses the header line end as line layout of empty records
+		const size_t line_bases = (r.length > 0 ? r.line_bases : 0);
+		const size_t line_width = (r.length > 0 ? r.line_width : 0);
+		ofs << fai_name(name(file, i)) << '\t' << r.length << '\t' << r.seq_offset << '\t' << line_bases << '\t' << line_width << '\n';
+	}
+	return (bool)ofs;
+}
+
+
+bool FastaIndex::find(const MappedFile &file, string_view key, size_t &i){
+	if(by_name.empty()){
+		for(size_t k = 0; k < records.size(); k++){
+			by_name.emplace(fai_name(name(file, k)), k);
+			by_name.emplace(name(file, k), k);
+		}
+	}
+	const auto it = by_name.find(key);
+	if(it == by_name.end()) return false;
+	i = it->second;
+	return true;
+}
+
+
+string_view FastaIndex::name(const MappedFile &file, const size_t i) const{
+	return string_view(file.data() + records[i].name_offset, records[i].name_length);
+}
+
+
+string_view FastaIndex::sequence(const MappedFile &file, const size_t i, string &buffer) const{
+	const FastaRecord &r = records[i];
+	const char *data = file.data();
+	if(r.n_lines == 0) return {};
+
+	// single line: skip leading blank lines
+	if(r.n_lines == 1){
+		const size_t begin = r.seq_offset + r.seq_bytes - r.length;
+		return string_view(data + begin, r.length);
+	}
+
+	buffer.clear();
+	buffer.reserve(r.length);
+	size_t pos = r.seq_offset;
+	const size_t end = r.seq_offset + r.seq_bytes;
+	while(pos < end){
+		size_t line_end;
+		const size_t next = line_at(data, file.size(), pos, line_end);
+		buffer.append(data + pos, line_end - pos);
+		pos = next;
+	}
+	return buffer;
+}
@@ -0,0 +1,55 @@
+/*
+ * Record table of a memory-mapped FASTA file, built in parallel.
+ */
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// location of one record; offsets are bytes from the start of the file
+struct FastaRecord{
+	size_t name_offset;  // first byte after '>'
+	size_t name_length;
+	size_t seq_offset;   // first byte after the header line
+	size_t seq_bytes;    // bytes up to the end of the last sequence line
+	size_t length;       // bases, without line ends
+	size_t line_bases;   // bases per line (0 if the line layout is irregular)
+	size_t line_width;   // bytes per line including the line end
+	size_t n_lines;      // non-empty sequence lines
+};
+
+class FastaIndex{
+public:
+	FastaIndex(){}
+
+	// scan file in byte ranges aligned to '>' lines, one range per thread;
+	// records are kept in file order whatever the thread count
+	void build(const MappedFile &file, int threads);
+
+	size_t size() const{ return records.size(); }
+	const FastaRecord &operator[](const size_t i) const{ return records[i]; }
+
+	// samtools-compatible .fai (NAME LENGTH OFFSET LINEBASES LINEWIDTH);
+	// write_fai() fails if a record has an irregular line layout
+	bool load_fai(const MappedFile &file, const string &fai_file);
+	bool write_fai(const MappedFile &file, const string &fai_file) const;
+
+	// index of the record whose name (up to the first whitespace, as in .fai)
+	// or full header is key
+	bool find(const MappedFile &file, string_view key, size_t &i);
+
+	string_view name(const MappedFile &file, const size_t i) const;
+
+	// a view into the file for single-line sequences, otherwise joined into buffer
+	string_view sequence(const MappedFile &file, const size_t i, string &buffer) const;
+private:
+	vector<FastaRecord> records;
+	unordered_map<string_view, size_t> by_name;
+};
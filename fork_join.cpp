@@ -0,0 +1,63 @@
+#include "fork_join.hpp"
+
+ForkJoinPool::ForkJoinPool(int threads){
+	for(int t = 1; t < threads; t++) workers.emplace_back(&ForkJoinPool::work, this);
+}
+
+
+ForkJoinPool::~ForkJoinPool(){
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	start.notify_all();
+	for(thread &worker : workers) worker.join();
+}
+
+
+void ForkJoinPool::run(int n_tasks, const function<void(int)> &body){
+	if(workers.empty() || n_tasks <= 1){
+		for(int task = 0; task < n_tasks; task++) body(task);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(mtx);
+		this->body = &body;
+		this->n_tasks = n_tasks;
+		next_task = 0;
+		busy = workers.size();
+		round++;
+	}
+	start.notify_all();
+
+	drain();
+
+	unique_lock<mutex> lock(mtx);
+	done.wait(lock, [this]{ return busy == 0; });
+	this->body = nullptr;
+}
+
+
+void ForkJoinPool::work(){
+	uint64_t seen = 0;
+	while(true){
+		{
+			unique_lock<mutex> lock(mtx);
+			start.wait(lock, [&]{ return round != seen || stopping; });
+			if(stopping) return;
+			seen = round;
+		}
+
+		drain();
+
+		lock_guard<mutex> lock(mtx);
+		if(--busy == 0) done.notify_one();
+	}
+}
+
+
+// run tasks of the current round until none are left
+void ForkJoinPool::drain(){
+	for(int task; (task = next_task.fetch_add(1)) < n_tasks;) (*body)(task);
+}
@@ -0,0 +1,47 @@
+/*
+ * Small fork-join thread pool for the parallel loops inside one fold.
+ *
+ * run() hands out task indices to the pool threads and to the calling thread
+ * and returns when all of them are done. The threads are kept for the
+ * lifetime of the pool, so a parallel loop costs one wake-up, not a spawn.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ForkJoinPool{
+public:
+	// threads: number of threads including the caller of run()
+	explicit ForkJoinPool(int threads);
+	~ForkJoinPool();
+	ForkJoinPool(const ForkJoinPool&) = delete;
+	ForkJoinPool &operator=(const ForkJoinPool&) = delete;
+
+	int size() const{ return workers.size() + 1; }
+
+	// calls body(task) for every task in [0, n_tasks), in any order and on any thread
+	void run(int n_tasks, const function<void(int)> &body);
+private:
+	vector<thread> workers;
+
+	mutex mtx;
+	condition_variable start, done;
+	const function<void(int)> *body = nullptr;
+	int n_tasks = 0;
+	atomic<int> next_task{0};
+	// workers still in the current round
+	int busy = 0;
+	uint64_t round = 0;
+	bool stopping = false;
+
+	void work();
+	void drain();
+};
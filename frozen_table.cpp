@@ -0,0 +1,240 @@
+#include "frozen_table.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <numeric>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// cells of a memory chunk, and of the spill write buffer
+const size_t CHUNK_CELLS = 1 << 16;
+const size_t BUFFER_CELLS = 1 << 18;
+// positions prefetched at once by the outside pass
+const int PREFETCH_POSITIONS = 512;
+
+} // namespace
+
+
+const Float *FrozenColumn::find(const int i) const{
+	const FrozenCell *it = lower_bound(cells, cells + n, i, [](const FrozenCell &cell, const int i){ return cell.i < i; });
+	return (it != cells + n && it->i == i ? &it->score : nullptr);
+}
+
+
+SpillFile::~SpillFile(){
+	unmap();
+#ifndef _WIN32
+	if(fd >= 0) close(fd);
+#endif
+}
+
+
+bool SpillFile::open(const string &dir){
+#ifdef _WIN32
+	return false;
+#else
+	string name = dir + "/lincapr-spill-XXXXXX";
+	fd = mkstemp(name.data());
+	if(fd < 0) return false;
+	// the file goes away with the descriptor
+	unlink(name.c_str());
+	buffer.resize(BUFFER_CELLS);
+	return true;
+#endif
+}
+
+
+void SpillFile::reset(const int n){
+	unmap();
+	failed = false;
+	buffered = 0;
+	written = 0;
+	n_positions = n;
+	next_position = 0;
+	position_offset.assign(n + 1, 0);
+#ifndef _WIN32
+	if(ftruncate(fd, 0) != 0) failed = true;
+#endif
+}
+
+
+FrozenCell *SpillFile::append(const int j, const size_t n, uint64_t &offset){
+	for(; next_position <= j; next_position++) position_offset[next_position] = written + buffered;
+	if(buffered + n > buffer.size()){
+		flush();
+		if(n > buffer.size()) buffer.resize(n);
+	}
+	offset = written + buffered;
+	buffered += n;
+	return buffer.data() + offset - written;
+}
+
+
+// write the buffered cells at the end of the file
+bool SpillFile::flush(){
+#ifndef _WIN32
+	const char *data = (const char*)buffer.data();
+	size_t left = buffered * sizeof(FrozenCell);
+	off_t pos = written * sizeof(FrozenCell);
+	while(left > 0 && !failed){
+		const ssize_t n = pwrite(fd, data, left, pos);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) failed = true;
+		else{
+			data += n;
+			left -= n;
+			pos += n;
+		}
+	}
+#endif
+	written += buffered;
+	buffered = 0;
+	return !failed;
+}
+
+
+bool SpillFile::finish(){
+	flush();
+	for(; next_position <= n_positions; next_position++) position_offset[next_position] = written;
+	if(failed) return false;
+	size = written * sizeof(FrozenCell);
+	if(size == 0) return true;
+#ifndef _WIN32
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED) return false;
+	mapped = (FrozenCell*)p;
+#endif
+	released = prefetched = n_positions;
+	return true;
+}
+
+
+void SpillFile::unmap(){
+#ifndef _WIN32
+	if(mapped) munmap(mapped, size);
+#endif
+	mapped = nullptr;
+	size = 0;
+}
+
+
+// madvise the pages of positions [from, to)
+void SpillFile::advise(const int from, const int to, const int advice) const{
+#ifndef _WIN32
+	const size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = position_offset[from] * sizeof(FrozenCell), end = position_offset[to] * sizeof(FrozenCell);
+	begin -= begin % page;
+	end = min(size, (end + page - 1) / page * page);
+	if(begin < end) madvise((char*)mapped + begin, end - begin, advice);
+#endif
+}
+
+
+void SpillFile::advise_backward(const int j){
+	if(!mapped) return;
+#ifndef _WIN32
+	// keep at least half a prefetch ahead
+	if(j - PREFETCH_POSITIONS / 2 < prefetched && prefetched > 0){
+		const int from = max(0, prefetched - PREFETCH_POSITIONS);
+		advise(from, prefetched, MADV_WILLNEED);
+		prefetched = from;
+	}
+	// the pages of positions above j + PREFETCH_POSITIONS are done
+	if(released - j > 2 * PREFETCH_POSITIONS){
+		advise(j + PREFETCH_POSITIONS, released, MADV_DONTNEED);
+		released = j + PREFETCH_POSITIONS;
+	}
+#endif
+}
+
+
+void SpillFile::advise_forward(){
+	if(!mapped) return;
+#ifndef _WIN32
+	madvise(mapped, size, MADV_SEQUENTIAL);
+#endif
+}
+
+
+void FrozenTable::reset(const int n, SpillFile *spill){
+	this->spill = spill;
+	columns.assign(n, nullptr);
+	sizes.assign(n, 0);
+	if(spill) offsets.assign(n, 0);
+	else vector<uint64_t>().swap(offsets);
+	chunk_used = chunk_size;
+}
+
+
+// room for n cells in the current memory chunk, or in a new one
+FrozenCell *FrozenTable::allocate(const size_t n){
+	if(chunk_used + n > chunk_size){
+		chunk_size = max(CHUNK_CELLS, n);
+		chunks.emplace_back(new FrozenCell[chunk_size]);
+		allocated += chunk_size;
+		chunk_used = 0;
+	}
+	FrozenCell *cells = chunks.back().get() + chunk_used;
+	chunk_used += n;
+	return cells;
+}
+
+
+void FrozenTable::freeze(const int j, Map<int, Float> &cells){
+	const uint32_t n = cells.size();
+	sizes[j] = n;
+	if(n == 0){
+		Map<int, Float>().swap(cells);
+		return;
+	}
+
+	staged.clear();
+	for(const auto [i, score] : cells) staged.push_back({i, 0, score});
+	Map<int, Float>().swap(cells);
+	order.resize(n);
+	iota(order.begin(), order.end(), 0);
+	sort(order.begin(), order.end(), [&](const uint32_t a, const uint32_t b){ return staged[a].i < staged[b].i; });
+
+	FrozenCell *out = (spill ? spill->append(j, n, offsets[j]) : allocate(n));
+	for(uint32_t k = 0; k < n; k++){
+		out[k].i = staged[order[k]].i;
+		out[k].score = staged[order[k]].score;
+	}
+	// the cell visited at step s sits at the place s was sorted to
+	for(uint32_t k = 0; k < n; k++) out[order[k]].next = k;
+	if(!spill) columns[j] = out;
+}
+
+
+void FrozenTable::finish(){
+	if(!spill) return;
+	for(size_t j = 0; j < columns.size(); j++) columns[j] = spill->base() + offsets[j];
+}
+
+
+void FrozenTable::release(){
+	fill(columns.begin(), columns.end(), nullptr);
+	fill(sizes.begin(), sizes.end(), 0);
+	chunks.clear();
+	chunk_used = chunk_size = allocated = 0;
+}
+
+
+void FrozenTable::clear(){
+	spill = nullptr;
+	vector<const FrozenCell*>().swap(columns);
+	vector<uint32_t>().swap(sizes);
+	vector<uint64_t>().swap(offsets);
+	chunks.clear();
+	chunk_used = chunk_size = allocated = 0;
+}
+
+
+size_t FrozenTable::memory_usage() const{
+	return allocated * sizeof(FrozenCell) + columns.size() * (sizeof(const FrozenCell*) + sizeof(uint32_t)) + offsets.size() * sizeof(uint64_t);
+}
@@ -0,0 +1,153 @@
+/*
+ * Frozen DP cells.
+ *
+ * Once the inside pass is done with position j, the cells alpha_*[j] are
+ * never written again. They are moved out of their hash maps into arrays of
+ * FrozenCell: half the bytes of a map node, sorted by i for lookups, and
+ * linked in the map's iteration order, so the outside and profile passes
+ * visit the states in the same order as from the maps and compute the same
+ * sums.
+ *
+ * The columns of a table live in memory, or, if it is given a SpillFile, in
+ * that file: they are appended during the inside pass and read through a
+ * memory mapping afterwards, backwards by the outside pass (with the pages
+ * ahead prefetched and the pages behind released) and forwards by the
+ * profile pass.
+ */
+#pragma once
+
+#include "miscs.hpp"
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct FrozenCell{
+	int32_t i;
+	// the cell at this place of the iteration order, as an index into the column
+	uint32_t next;
+	Float score;
+};
+static_assert(sizeof(FrozenCell) == 16, "unexpected FrozenCell padding");
+
+// read-only view of one frozen column
+class FrozenColumn{
+public:
+	class iterator{
+	public:
+		using iterator_category = forward_iterator_tag;
+		using value_type = pair<int, Float>;
+		using difference_type = ptrdiff_t;
+		using pointer = const value_type*;
+		using reference = value_type;
+
+		iterator(const FrozenCell *cells, const uint32_t k) : cells(cells), k(k){}
+		value_type operator*() const{
+			const FrozenCell &cell = cells[cells[k].next];
+			return {cell.i, cell.score};
+		}
+		iterator &operator++(){ k++; return *this; }
+		bool operator==(const iterator &other) const{ return k == other.k; }
+		bool operator!=(const iterator &other) const{ return k != other.k; }
+	private:
+		const FrozenCell *cells;
+		uint32_t k;
+	};
+
+	FrozenColumn(const FrozenCell *cells, const uint32_t n) : cells(cells), n(n){}
+	size_t size() const{ return n; }
+	bool empty() const{ return n == 0; }
+	iterator begin() const{ return {cells, 0}; }
+	iterator end() const{ return {cells, n}; }
+
+	// score of state i, nullptr if there is none
+	const Float *find(int i) const;
+private:
+	const FrozenCell *cells;
+	uint32_t n;
+};
+
+// scratch file holding the spilled columns of one engine's run
+class SpillFile{
+public:
+	SpillFile(){}
+	~SpillFile();
+	SpillFile(const SpillFile&) = delete;
+	SpillFile &operator=(const SpillFile&) = delete;
+
+	// create an unnamed file in dir; false if it cannot
+	bool open(const string &dir);
+	bool is_open() const{ return fd >= 0; }
+
+	// start a run of n positions: empty the file
+	void reset(int n);
+	// room for the n cells of a column of position j (positions in increasing
+	// order), to be filled before the next call; offset is set to their
+	// place in the file, in cells
+	FrozenCell *append(int j, size_t n, uint64_t &offset);
+	// after the last append: map the file; false if writing or mapping failed
+	bool finish();
+	const FrozenCell *base() const{ return mapped; }
+
+	// outside pass at position j, going down: read ahead below j, release above
+	void advise_backward(int j);
+	// profile pass: read forwards
+	void advise_forward();
+	size_t bytes() const{ return size; }
+private:
+	int fd = -1;
+	bool failed = false;
+	// cells appended, and cells of them written to the file
+	vector<FrozenCell> buffer;
+	size_t buffered = 0;
+	uint64_t written = 0;
+	// first cell of the columns of each position
+	vector<uint64_t> position_offset;
+	int n_positions = 0, next_position = 0;
+	FrozenCell *mapped = nullptr;
+	size_t size = 0;
+	// positions below released, and below prefetched
+	int released = 0, prefetched = 0;
+
+	bool flush();
+	void unmap();
+	void advise(int from, int to, int advice) const;
+};
+
+class FrozenTable{
+public:
+	// n empty columns; with spill, columns go to the file
+	void reset(int n, SpillFile *spill);
+	// move the cells of column j out of cells (left empty, without buckets)
+	void freeze(int j, Map<int, Float> &cells);
+	// after the last freeze: resolve the spilled columns in the mapped file
+	void finish();
+	// empty every column (in memory) to freeze them again
+	void release();
+	void clear();
+
+	FrozenColumn operator[](const int j) const{ return {columns[j], sizes[j]}; }
+	// heap bytes of the cells kept in memory and of the column index
+	size_t memory_usage() const;
+private:
+	SpillFile *spill = nullptr;
+	vector<const FrozenCell*> columns;
+	vector<uint32_t> sizes;
+	// spilled columns: offsets in the file until finish()
+	vector<uint64_t> offsets;
+
+	// memory columns: chunks filled in order
+	vector<unique_ptr<FrozenCell[]>> chunks;
+	size_t chunk_used = 0, chunk_size = 0, allocated = 0;
+
+	// scratch for freeze(): the cells in iteration order, and their sort order
+	vector<FrozenCell> staged;
+	vector<uint32_t> order;
+
+	FrozenCell *allocate(size_t n);
+};
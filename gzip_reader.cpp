@@ -0,0 +1,256 @@
+#include "gzip_reader.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+#ifdef LCR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+// chunks kept ahead of the reader
+const size_t MAX_CHUNKS = 16;
+
+#ifdef LCR_HAVE_ZLIB
+const size_t CHUNK_SIZE = 1 << 20;
+// BGZF blocks inflated per parallel batch
+const int BGZF_BATCH = 256;
+const size_t BGZF_HEADER = 18;
+
+inline uint16_t read_u16(const unsigned char *p){ return p[0] | (p[1] << 8); }
+inline uint32_t read_u32(const unsigned char *p){ return read_u16(p) | ((uint32_t)read_u16(p + 2) << 16); }
+
+// returns whether header is a BGZF member header (FEXTRA with a 'BC' subfield)
+bool is_bgzf_header(const unsigned char *h){
+	return h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && (h[3] & 4)
+		&& read_u16(h + 10) == 6 && h[12] == 'B' && h[13] == 'C' && read_u16(h + 14) == 2;
+}
+#endif
+
+} // namespace
+
+
+bool GzipStreamBuf::is_gzip(const string &file_name){
+	// reading the magic bytes of a pipe would consume them
+	error_code ec;
+	if(!filesystem::is_regular_file(file_name, ec)) return false;
+
+	FILE *f = fopen(file_name.c_str(), "rb");
+	if(!f) return false;
+	unsigned char magic[2];
+	const bool gz = (fread(magic, 1, 2, f) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+	fclose(f);
+	return gz;
+}
+
+
+bool GzipStreamBuf::open(const string &file_name, int threads){
+	close();
+#ifndef LCR_HAVE_ZLIB
+	return false;
+#else
+	fp = fopen(file_name.c_str(), "rb");
+	if(!fp) return false;
+
+	unsigned char header[BGZF_HEADER];
+	const bool bgzf = (fread(header, 1, BGZF_HEADER, fp) == BGZF_HEADER && is_bgzf_header(header));
+	rewind(fp);
+
+	this->threads = (threads > 0 ? threads : max(1u, thread::hardware_concurrency()));
+	finished = stopping = error = false;
+	if(bgzf) producer = thread(&GzipStreamBuf::inflate_bgzf, this);
+	else producer = thread(&GzipStreamBuf::inflate_gzip, this);
+	return true;
+#endif
+}
+
+
+// stop the background thread and release the file
+void GzipStreamBuf::close(){
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	not_full.notify_all();
+	if(producer.joinable()) producer.join();
+	if(fp) fclose(fp);
+	fp = nullptr;
+
+	chunks.clear();
+	current.clear();
+	setg(nullptr, nullptr, nullptr);
+}
+
+
+bool GzipStreamBuf::failed() const{
+	lock_guard<mutex> lock(mtx);
+	return error;
+}
+
+
+// hand the next decompressed chunk to the reader
+GzipStreamBuf::int_type GzipStreamBuf::underflow(){
+	if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	unique_lock<mutex> lock(mtx);
+	not_empty.wait(lock, [this]{ return !chunks.empty() || finished; });
+	if(chunks.empty()) return traits_type::eof();
+
+	current = move(chunks.front());
+	chunks.pop_front();
+	lock.unlock();
+	not_full.notify_one();
+
+	setg(current.data(), current.data(), current.data() + current.size());
+	return traits_type::to_int_type(*gptr());
+}
+
+
+// queue a chunk for the reader; returns false if the reader has gone away
+bool GzipStreamBuf::push(vector<char> &&chunk){
+	if(chunk.empty()) return true;
+	unique_lock<mutex> lock(mtx);
+	not_full.wait(lock, [this]{ return chunks.size() < MAX_CHUNKS || stopping; });
+	if(stopping) return false;
+	chunks.push_back(move(chunk));
+	lock.unlock();
+	not_empty.notify_one();
+	return true;
+}
+
+
+void GzipStreamBuf::finish(const bool ok){
+	{
+		lock_guard<mutex> lock(mtx);
+		finished = true;
+		error = !ok;
+	}
+	not_empty.notify_all();
+}
+
+
+// single-threaded inflate of (possibly concatenated) gzip members
+void GzipStreamBuf::inflate_gzip(){
+#ifdef LCR_HAVE_ZLIB
+	z_stream zs{};
+	if(inflateInit2(&zs, 15 + 32) != Z_OK){
+		finish(false);
+		return;
+	}
+
+	vector<unsigned char> in(CHUNK_SIZE);
+	vector<char> out(CHUNK_SIZE);
+	bool ok = true, member_end = false;
+	int ret = Z_OK;
+	while(ok){
+		if(zs.avail_in == 0){
+			zs.avail_in = fread(in.data(), 1, in.size(), fp);
+			zs.next_in = in.data();
+			if(zs.avail_in == 0){
+				ok = member_end;
+				break;
+			}
+		}
+
+		// start the next member after a member ends
+		if(ret == Z_STREAM_END){
+			inflateReset(&zs);
+		}
+
+		zs.next_out = (Bytef*)out.data();
+		zs.avail_out = out.size();
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR){
+			ok = false;
+			break;
+		}
+		member_end = (ret == Z_STREAM_END);
+
+		out.resize(out.size() - zs.avail_out);
+		if(!push(move(out))) break;
+		out.assign(CHUNK_SIZE, 0);
+	}
+
+	inflateEnd(&zs);
+	finish(ok);
+#endif
+}
+
+
+// BGZF: read a batch of blocks, inflate them in parallel, queue them in order
+void GzipStreamBuf::inflate_bgzf(){
+#ifdef LCR_HAVE_ZLIB
+	bool ok = true, eof = false, stopped = false;
+	while(ok && !eof && !stopped){
+		// a bad block ends the input after the blocks read before it
+		bool read_ok = true;
+		// read up to BGZF_BATCH whole blocks
+		vector<vector<unsigned char>> blocks;
+		while((int)blocks.size() < BGZF_BATCH){
+			unsigned char header[BGZF_HEADER];
+			const size_t n = fread(header, 1, BGZF_HEADER, fp);
+			if(n == 0){
+				eof = true;
+				break;
+			}
+			if(n != BGZF_HEADER || !is_bgzf_header(header)){
+				read_ok = false;
+				break;
+			}
+			const size_t block_size = read_u16(header + 16) + 1;
+			if(block_size < BGZF_HEADER + 8){
+				read_ok = false;
+				break;
+			}
+			vector<unsigned char> block(block_size);
+			memcpy(block.data(), header, BGZF_HEADER);
+			if(fread(block.data() + BGZF_HEADER, 1, block_size - BGZF_HEADER, fp) != block_size - BGZF_HEADER){
+				read_ok = false;
+				break;
+			}
+			blocks.push_back(move(block));
+		}
+
+		// raw-inflate each block's deflate payload; ISIZE and CRC32 are in the trailer
+		vector<vector<char>> outputs(blocks.size());
+		vector<char> block_ok(blocks.size(), 0);
+		auto work = [&](const int t){
+			for(size_t b = t; b < blocks.size(); b += threads){
+				const vector<unsigned char> &block = blocks[b];
+				const unsigned char *trailer = block.data() + block.size() - 8;
+				vector<char> &out = outputs[b];
+				out.resize(read_u32(trailer + 4));
+
+				z_stream zs{};
+				if(inflateInit2(&zs, -15) != Z_OK) continue;
+				zs.next_in = (Bytef*)block.data() + BGZF_HEADER;
+				zs.avail_in = block.size() - BGZF_HEADER - 8;
+				// zlib rejects a null next_out, e.g. for the empty EOF block
+				Bytef empty;
+				zs.next_out = (out.empty() ? &empty : (Bytef*)out.data());
+				zs.avail_out = out.size();
+				const int ret = inflate(&zs, Z_FINISH);
+				inflateEnd(&zs);
+
+				block_ok[b] = (ret == Z_STREAM_END && zs.avail_out == 0
+					&& crc32(0, (const Bytef*)out.data(), out.size()) == read_u32(trailer));
+			}
+		};
+		const int n_workers = min<int>(threads, blocks.size());
+		vector<thread> workers;
+		for(int t = 1; t < n_workers; t++) workers.emplace_back(work, t);
+		if(n_workers > 0) work(0);
+		for(thread &worker : workers) worker.join();
+
+		for(size_t b = 0; b < blocks.size() && ok && !stopped; b++){
+			if(!block_ok[b]) ok = false;
+			else if(!push(move(outputs[b]))) stopped = true;
+		}
+		ok = ok && read_ok;
+	}
+	finish(ok);
+#endif
+}
@@ -0,0 +1,56 @@
+/*
+ * gzip / BGZF input decompressed on background threads.
+ *
+ * Plain gzip (including concatenated members) is inflated by one background
+ * thread. Block-gzip (BGZF, as written by bgzip) splits the file into
+ * independent <= 64 KB members, so batches of blocks are inflated in parallel
+ * and handed to the reader in file order.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class GzipStreamBuf : public streambuf{
+public:
+	GzipStreamBuf(){}
+	~GzipStreamBuf(){ close(); }
+	GzipStreamBuf(const GzipStreamBuf&) = delete;
+	GzipStreamBuf &operator=(const GzipStreamBuf&) = delete;
+
+	// returns whether file_name is a regular file starting with the gzip magic bytes
+	static bool is_gzip(const string &file_name);
+
+	// start decompressing file_name; threads is used for BGZF (0: all cores)
+	bool open(const string &file_name, int threads = 0);
+	void close();
+
+	// set when the input was truncated or corrupt
+	bool failed() const;
+protected:
+	int_type underflow() override;
+private:
+	FILE *fp = nullptr;
+	int threads = 1;
+	thread producer;
+
+	// decompressed chunks in file order
+	mutable mutex mtx;
+	condition_variable not_empty, not_full;
+	deque<vector<char>> chunks;
+	vector<char> current;
+	bool finished = false, stopping = false, error = false;
+
+	bool push(vector<char> &&chunk);
+	void finish(const bool ok);
+	void inflate_gzip();
+	void inflate_bgzf();
+};
@@ -1,17 +1,226 @@
 #include "LinCapR.hpp"
 #include "FileReader.hpp"
+#include "energy_param_file.hpp"
+#include "profile_writer.hpp"
+#include "batch_runner.hpp"
+#include "shard_merge.hpp"
+#include "output_resume.hpp"
+#include "profile_server.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <sstream>
+#include <thread>
+
+// returns whether argv[i] is option name, given as "name value" or "name=value"
+// on a match, value is set (nullptr if missing) and i is moved past the value
+bool match_option(const int argc, char **argv, int &i, const char *name, const char *&value){
+	const size_t len = strlen(name);
+	if(strncmp(argv[i], name, len) != 0) return false;
+	if(argv[i][len] == '='){
+		value = argv[i] + len + 1;
+		return true;
+	}
+	if(argv[i][len] != '\0') return false;
+	value = (i + 1 < argc ? argv[++i] : nullptr);
+	return true;
+}
+
+// parses a byte count with an optional K, M, G or T suffix (powers of 1024)
+bool parse_size(const char *value, size_t &bytes){
+	if(!value || !isdigit(value[0])) return false;
+	char *end;
+	const double number = strtod(value, &end);
+	double unit = 1;
+	switch(toupper(*end)){
+	case 'T': unit *= 1024; [[fallthrough]];
+	case 'G': unit *= 1024; [[fallthrough]];
+	case 'M': unit *= 1024; [[fallthrough]];
+	case 'K': unit *= 1024; end++; break;
+	}
+	if(toupper(*end) == 'B') end++;
+	if(*end != '\0') return false;
+	bytes = number * unit;
+	return true;
+}
+
+// Usage: ./LinCapR convert <profile_file> <output_file> [--precision <n>]
+// writes a binary profile file in the text format
+int convert_profile(int argc, char **argv){
+	if(argc < 4){
+		cout << "Usage: ./LinCapR convert <profile_file> <output_file> [--precision <n>]" << endl;
+		return 1;
+	}
+
+	int precision = 6;
+	for(int i = 4; i < argc; i++){
+		const char *value = nullptr;
+		if(match_option(argc, argv, i, "--precision", value)){
+			if(!value || atoi(value) < 1 || atoi(value) > 17){
+				cout << "Error: --precision requires a number from 1 to 17" << endl;
+				return 1;
+			}
+			precision = atoi(value);
+		}else{
+			cout << "Error: invalid option: " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	ProfileFile input;
+	if(!input.open(argv[2])) return 1;
+	ProfileWriter writer;
+	if(!writer.open(argv[3], ProfileFormat::Text, precision)) return 1;
+
+	for(size_t i = 0; i < input.size(); i++){
+		Profile profile;
+		if(!input.get(i, profile)){
+			cout << "Error: profile file is truncated or corrupt: " << argv[2] << endl;
+			return 1;
+		}
+		writer.write(move(profile));
+	}
+
+	if(!writer.close()){
+		cout << "Error: cannot write output file: " << argv[3] << endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Usage: ./LinCapR merge <output_file> <shard_output>...
+// merges the outputs of all shards of a --shard run in input order
+int merge_profiles(int argc, char **argv){
+	if(argc < 4){
+		cout << "Usage: ./LinCapR merge <output_file> <shard_output>..." << endl;
+		return 1;
+	}
+	return (merge_shards(argv[2], vector<string>(argv + 3, argv + argc)) ? 0 : 1);
+}
+
+// Usage: ./LinCapR serve <socket_path> [options]
+// folds the requests of local clients on a pool of engines, see profile_server.hpp
+int serve_profiles(int argc, char **argv){
+	if(argc < 3){
+		cout << "Usage: ./LinCapR serve <socket_path> [--beam <n>] [--threads <n>] [--energy <model>] [--param-file <file>]" << endl;
+		cout << "                       [--max-clients <n>] [--max-queue <n>]" << endl;
+		return 1;
+	}
+
+	int beam_size = 100, threads = 0, max_clients = 64;
+	size_t max_queue = 0;
+	energy::Model energy_model = energy::Model::Turner2004;
+	bool energy_set = false;
+	string param_file;
+	for(int i = 3; i < argc; i++){
+		const char *value = nullptr;
+		if(match_option(argc, argv, i, "--beam", value)){
+			if(!value || !isdigit(value[0])){
+				cout << "Error: --beam requires a number (0: no beam)" << endl;
+				return 1;
+			}
+			beam_size = atoi(value);
+		}else if(match_option(argc, argv, i, "--threads", value)){
+			if(!value || !isdigit(value[0])){
+				cout << "Error: --threads requires a number (0: all cores)" << endl;
+				return 1;
+			}
+			threads = atoi(value);
+		}else if(match_option(argc, argv, i, "--energy", value)){
+			if(value && strcmp(value, "turner2004") == 0){
+				energy_model = energy::Model::Turner2004;
+			}else if(value && strcmp(value, "turner1999") == 0){
+				energy_model = energy::Model::Turner1999;
+			}else{
+				cout << "Error: --energy requires turner2004 or turner1999" << endl;
+				return 1;
+			}
+			energy_set = true;
+		}else if(match_option(argc, argv, i, "--param-file", value)){
+			if(!value){
+				cout << "Error: --param-file requires an argument" << endl;
+				return 1;
+			}
+			param_file = value;
+		}else if(match_option(argc, argv, i, "--max-clients", value)){
+			if(!value || atoi(value) < 1){
+				cout << "Error: --max-clients requires a positive number" << endl;
+				return 1;
+			}
+			max_clients = atoi(value);
+		}else if(match_option(argc, argv, i, "--max-queue", value)){
+			if(!value || atoi(value) < 1){
+				cout << "Error: --max-queue requires a positive number" << endl;
+				return 1;
+			}
+			max_queue = atoi(value);
+		}else{
+			cout << "Error: invalid option: " << argv[i] << endl;
+			return 1;
+		}
+	}
+
+	if(energy_set && !param_file.empty()){
+		cout << "Error: --energy cannot be combined with --param-file" << endl;
+		return 1;
+	}
+
+	energy::ParamFile params;
+	if(!param_file.empty() && !params.load(param_file)) return 1;
+	const energy::Params &energy_params = (!param_file.empty() ? params.params() : energy::get_params(energy_model));
+
+	ProfileServer server(threads, beam_size, energy_params, max_clients, max_queue);
+	return (server.run(argv[2]) ? 0 : 1);
+}
 
 // Usage: ./LinCapR <input_file> <output_file> <beam_size> [options]
 int main(int argc, char **argv){
+	if(argc >= 2 && strcmp(argv[1], "convert") == 0) return convert_profile(argc, argv);
+	if(argc >= 2 && strcmp(argv[1], "merge") == 0) return merge_profiles(argc, argv);
+	if(argc >= 2 && strcmp(argv[1], "serve") == 0) return serve_profiles(argc, argv);
 	if(argc < 4){
 		cout << "Usage: ./LinCapR <input_file> <output_file> <beam_size> [options]" << endl;
+		cout << "       ./LinCapR convert <profile_file> <output_file> [--precision <n>]" << endl;
+		cout << "       ./LinCapR merge <output_file> <shard_output>..." << endl;
+		cout << "       ./LinCapR serve <socket_path> [--beam <n>] [--threads <n>] [--energy <model>] ..." << endl;
 		cout << "Options:" << endl;
-		cout << "  -e                 Output ensemble energy" << endl;
-		cout << "  --energy <model>   Energy model: turner2004 (default) or turner1999" << endl;
+		cout << "  -e                   Output ensemble energy" << endl;
+		cout << "  --energy <model>     Energy model: turner2004 (default) or turner1999" << endl;
+		cout << "  --threads <n>        Fold n records in parallel (0: all cores, default: 1)" << endl;
+		cout << "  --fold-threads <n>   Fold each record on n threads (0: all cores, default: 1)" << endl;
+		cout << "  --max-memory <size>  With --threads: start records only while their estimated" << endl;
+		cout << "                       DP memory fits in size (e.g. 16G; default: no limit)" << endl;
+		cout << "  --time-budget <s>    Refold a record with half the beam if it takes over s seconds" << endl;
+		cout << "  --state-budget <n>   Refold a record with half the beam if it keeps over n DP states" << endl;
+		cout << "  --window <n>         Fold records longer than n bases as overlapping windows and stitch" << endl;
+		cout << "                       their profiles (G_ensemble of such records: nan)" << endl;
+		cout << "  --window-overlap <n> Overlap of consecutive windows, at most half the window (default: 1/4)" << endl;
+		cout << "  --dedup-memory <size> Fold records repeating an earlier sequence only once, keeping up to" << endl;
+		cout << "                       size of profiles for them (e.g. 256M; default: 0, fold every record)" << endl;
+		cout << "  --cache <dir>        Reuse the profiles of sequences folded before with the same settings" << endl;
+		cout << "  --cache-size <size>  Size limit of the cache, least recently used entries go first" << endl;
+		cout << "                       (default: 10G; 0: no limit)" << endl;
+		cout << "  --spill-dir <dir>    Keep the inside tables of records of 10000 bases or more in" << endl;
+		cout << "                       scratch files in dir instead of memory" << endl;
+		cout << "  --checkpoint <n|auto> Keep part of the inside tables only every n positions and" << endl;
+		cout << "                       recompute it in the outside pass (auto: about sqrt(30 * length))" << endl;
+		cout << "  --energy-only        Compute only the ensemble energies and write \"name<TAB>G_ensemble\"" << endl;
+		cout << "                       lines instead of profiles" << endl;
+		cout << "  --param-file <file>  Load energy parameters from a ViennaRNA .par file (not with --energy)" << endl;
+		cout << "  --param-cache <file> Binary cache of the parameter file, reused on later runs" << endl;
+		cout << "  --parse-threads <n>  Index the input FASTA on n threads before folding" << endl;
+		cout << "  --format <format>    Output format: text (default) or binary" << endl;
+		cout << "  --precision <n>      Significant digits of output probabilities (default: 6)" << endl;
+		cout << "  --quantize           Write probabilities as 8-bit integers q (q / 255)" << endl;
+		cout << "  --sparse             With --format binary: quantize and omit zero contexts" << endl;
+		cout << "  --records <a,b,...>  Fold only the named records (uses/creates <input_file>.fai)" << endl;
+		cout << "  --records-file <f>   Fold only the records named in f, one per line" << endl;
+		cout << "  --record-range <a-b> Fold only records a to b (1-based, inclusive)" << endl;
+		cout << "  --resume             Keep the records of an interrupted run in output_file, fold the rest" << endl;
+		cout << "  --shard <k/n>        Fold only shard k of n (1-based) and write <output_file>.idx" << endl;
+		cout << "  --shard-by <mode>    index (default: every n-th record) or length (contiguous," << endl;
+		cout << "                       balanced by bases; needs an uncompressed regular input file)" << endl;
 		return 1;
 	}
 
@@ -23,31 +232,206 @@ int main(int argc, char **argv){
 	// get options
 	bool output_energy = false;
 	energy::Model energy_model = energy::Model::Turner2004;
+	bool energy_set = false;
+	string param_file, param_cache;
+	int parse_threads = 0;
+	int threads = 1;
+	int fold_threads = 1;
+	size_t max_memory = 0;
+	double time_budget = 0;
+	size_t state_budget = 0;
+	size_t dedup_memory = 0;
+	size_t window = 0, window_overlap = 0;
+	bool window_overlap_set = false;
+	string cache_dir;
+	size_t cache_size = (size_t)10 << 30;
+	string spill_dir;
+	int checkpoint_interval = 0;
+	bool energy_only = false;
+	ProfileFormat format = ProfileFormat::Text;
+	int precision = 6;
+	ProfileEncoding encoding = PROFILE_FLOAT32;
+	vector<string> record_names;
+	vector<pair<size_t, size_t>> record_ranges;
+	bool select_records = false;
+	size_t shard_k = 0, shard_n = 0;
+	bool shard_by_length = false;
+	bool resume = false;
 	for(int i = 4; i < argc; i++){
+		const char *value = nullptr;
 		if(strcmp(argv[i], "-e") == 0){
 			output_energy = true;
-		}else if(strcmp(argv[i], "--energy") == 0){
-			if(i + 1 >= argc){
+		}else if(match_option(argc, argv, i, "--energy", value)){
+			if(!value){
 				cout << "Error: --energy requires an argument (turner2004 or turner1999)" << endl;
 				return 1;
 			}
-			const char *choice = argv[++i];
-			if(strcmp(choice, "turner2004") == 0){
+			if(strcmp(value, "turner2004") == 0){
 				energy_model = energy::Model::Turner2004;
-			}else if(strcmp(choice, "turner1999") == 0){
+			}else if(strcmp(value, "turner1999") == 0){
 				energy_model = energy::Model::Turner1999;
 			}else{
-				cout << "Error: invalid energy model: " << choice << endl;
+				cout << "Error: invalid energy model: " << value << endl;
 				return 1;
 			}
-		}else if(strncmp(argv[i], "--energy=", 9) == 0){
-			const char *choice = argv[i] + 9;
-			if(strcmp(choice, "turner2004") == 0){
-				energy_model = energy::Model::Turner2004;
-			}else if(strcmp(choice, "turner1999") == 0){
-				energy_model = energy::Model::Turner1999;
+			energy_set = true;
+		}else if(match_option(argc, argv, i, "--param-file", value)){
+			if(!value){
+				cout << "Error: --param-file requires an argument" << endl;
+				return 1;
+			}
+			param_file = value;
+		}else if(match_option(argc, argv, i, "--param-cache", value)){
+			if(!value){
+				cout << "Error: --param-cache requires an argument" << endl;
+				return 1;
+			}
+			param_cache = value;
+		}else if(match_option(argc, argv, i, "--threads", value)){
+			if(!value || !isdigit(value[0])){
+				cout << "Error: --threads requires a number (0: all cores)" << endl;
+				return 1;
+			}
+			threads = atoi(value);
+		}else if(match_option(argc, argv, i, "--fold-threads", value)){
+			if(!value || !isdigit(value[0])){
+				cout << "Error: --fold-threads requires a number (0: all cores)" << endl;
+				return 1;
+			}
+			fold_threads = atoi(value);
+			if(fold_threads == 0) fold_threads = max(1u, thread::hardware_concurrency());
+		}else if(match_option(argc, argv, i, "--max-memory", value)){
+			if(!parse_size(value, max_memory)){
+				cout << "Error: --max-memory requires a size such as 512M or 16G" << endl;
+				return 1;
+			}
+		}else if(match_option(argc, argv, i, "--time-budget", value)){
+			if(!value || !(atof(value) > 0)){
+				cout << "Error: --time-budget requires a positive number of seconds" << endl;
+				return 1;
+			}
+			time_budget = atof(value);
+		}else if(match_option(argc, argv, i, "--state-budget", value)){
+			if(!value || !(atof(value) >= 1)){
+				cout << "Error: --state-budget requires a positive number of states" << endl;
+				return 1;
+			}
+			state_budget = atof(value);
+		}else if(match_option(argc, argv, i, "--window", value)){
+			if(!value || atol(value) < 1){
+				cout << "Error: --window requires a positive number of bases" << endl;
+				return 1;
+			}
+			window = atol(value);
+		}else if(match_option(argc, argv, i, "--window-overlap", value)){
+			if(!value || !isdigit(value[0])){
+				cout << "Error: --window-overlap requires a number of bases" << endl;
+				return 1;
+			}
+			window_overlap = atol(value);
+			window_overlap_set = true;
+		}else if(match_option(argc, argv, i, "--dedup-memory", value)){
+			if(!parse_size(value, dedup_memory)){
+				cout << "Error: --dedup-memory requires a size such as 256M (0: fold repeated sequences again)" << endl;
+				return 1;
+			}
+		}else if(match_option(argc, argv, i, "--cache", value)){
+			if(!value){
+				cout << "Error: --cache requires a directory" << endl;
+				return 1;
+			}
+			cache_dir = value;
+		}else if(match_option(argc, argv, i, "--cache-size", value)){
+			if(!parse_size(value, cache_size)){
+				cout << "Error: --cache-size requires a size such as 512M or 16G (0: no limit)" << endl;
+				return 1;
+			}
+		}else if(match_option(argc, argv, i, "--spill-dir", value)){
+			if(!value){
+				cout << "Error: --spill-dir requires a directory" << endl;
+				return 1;
+			}
+			spill_dir = value;
+		}else if(match_option(argc, argv, i, "--checkpoint", value)){
+			if(value && strcmp(value, "auto") == 0){
+				checkpoint_interval = LinCapR::CHECKPOINT_AUTO;
+			}else if(value && atoi(value) >= 1){
+				checkpoint_interval = atoi(value);
 			}else{
-				cout << "Error: invalid energy model: " << choice << endl;
+				cout << "Error: --checkpoint requires a positive number of positions or auto" << endl;
+				return 1;
+			}
+		}else if(match_option(argc, argv, i, "--parse-threads", value)){
+			if(!value || atoi(value) < 1){
+				cout << "Error: --parse-threads requires a positive integer" << endl;
+				return 1;
+			}
+			parse_threads = atoi(value);
+		}else if(match_option(argc, argv, i, "--format", value)){
+			if(value && strcmp(value, "text") == 0){
+				format = ProfileFormat::Text;
+			}else if(value && strcmp(value, "binary") == 0){
+				format = ProfileFormat::Binary;
+			}else{
+				cout << "Error: --format requires text or binary" << endl;
+				return 1;
+			}
+		}else if(match_option(argc, argv, i, "--precision", value)){
+			if(!value || atoi(value) < 1 || atoi(value) > 17){
+				cout << "Error: --precision requires a number from 1 to 17" << endl;
+				return 1;
+			}
+			precision = atoi(value);
+		}else if(strcmp(argv[i], "--quantize") == 0){
+			if(encoding == PROFILE_FLOAT32) encoding = PROFILE_Q8;
+		}else if(strcmp(argv[i], "--sparse") == 0){
+			encoding = PROFILE_Q8_SPARSE;
+		}else if(match_option(argc, argv, i, "--records", value)){
+			if(!value){
+				cout << "Error: --records requires a comma-separated list of names" << endl;
+				return 1;
+			}
+			stringstream ss(value);
+			string name;
+			while(getline(ss, name, ',')) if(!name.empty()) record_names.push_back(name);
+			select_records = true;
+		}else if(match_option(argc, argv, i, "--records-file", value)){
+			ifstream ifs(value ? value : "");
+			if(!ifs){
+				cout << "Error: cannot open records file: " << (value ? value : "") << endl;
+				return 1;
+			}
+			string name;
+			while(getline(ifs, name)){
+				while(!name.empty() && isspace(name.back())) name.pop_back();
+				if(!name.empty()) record_names.push_back(name);
+			}
+			select_records = true;
+		}else if(match_option(argc, argv, i, "--record-range", value)){
+			size_t first = 0, last = 0;
+			if(!value || sscanf(value, "%zu-%zu", &first, &last) != 2 || first < 1 || first > last){
+				cout << "Error: --record-range requires a range like 1-100" << endl;
+				return 1;
+			}
+			record_ranges.push_back({first - 1, last - 1});
+			select_records = true;
+		}else if(strcmp(argv[i], "--energy-only") == 0){
+			energy_only = true;
+		}else if(strcmp(argv[i], "--resume") == 0){
+			resume = true;
+		}else if(match_option(argc, argv, i, "--shard", value)){
+			if(!value || sscanf(value, "%zu/%zu", &shard_k, &shard_n) != 2 || shard_k < 1 || shard_k > shard_n){
+				cout << "Error: --shard requires k/n with 1 <= k <= n, like 3/100" << endl;
+				return 1;
+			}
+			shard_k--;
+		}else if(match_option(argc, argv, i, "--shard-by", value)){
+			if(value && strcmp(value, "index") == 0){
+				shard_by_length = false;
+			}else if(value && strcmp(value, "length") == 0){
+				shard_by_length = true;
+			}else{
+				cout << "Error: --shard-by requires index or length" << endl;
 				return 1;
 			}
 		}else{
@@ -56,37 +440,115 @@ int main(int argc, char **argv){
 		}
 	}
 
-	// read fasta file
+	if(encoding == PROFILE_Q8_SPARSE && format != ProfileFormat::Binary){
+		cout << "Error: --sparse requires --format binary" << endl;
+		return 1;
+	}
+	if(energy_only){
+		if(format != ProfileFormat::Text || encoding != PROFILE_FLOAT32 || window > 0){
+			cout << "Error: --energy-only cannot be combined with --format binary, --quantize, --sparse or --window" << endl;
+			return 1;
+		}
+		format = ProfileFormat::Energy;
+	}
+	if(energy_set && (!param_file.empty() || !param_cache.empty())){
+		cout << "Error: --energy cannot be combined with --param-file or --param-cache" << endl;
+		return 1;
+	}
+	if(!window_overlap_set) window_overlap = window / 4;
+	if(window_overlap_set && (window == 0 || window_overlap > window / 2)){
+		cout << "Error: --window-overlap requires --window and at most half of it" << endl;
+		return 1;
+	}
+
+	// load runtime energy parameters
+	energy::ParamFile params;
+	if(!param_cache.empty()){
+		if(!params.load(param_file, param_cache)) return 1;
+	}else if(!param_file.empty()){
+		if(!params.load(param_file)) return 1;
+	}
+	const bool runtime_params = !param_file.empty() || !param_cache.empty();
+	const energy::Params &energy_params = (runtime_params ? params.params() : energy::get_params(energy_model));
+
+	// open fasta file; records are folded as they are read
 	FileReader fr;
-	vector<string> seq, seq_name;
-	fr.read(input_file, seq, seq_name);
+	if(!fr.open(input_file)) return 1;
+	if(select_records){
+		// seek the requested records through <input_file>.fai
+		if(!fr.use_fai(max(parse_threads, 1))){
+			cout << "Error: record selection needs an uncompressed regular input file: " << input_file << endl;
+			return 1;
+		}
+		vector<size_t> ids;
+		for(const string &name : record_names){
+			size_t id;
+			if(!fr.find(name, id)){
+				cout << "Error: record not found: " << name << endl;
+				return 1;
+			}
+			ids.push_back(id);
+		}
+		for(const auto &[first, last] : record_ranges){
+			if(last >= fr.n_records()){
+				cout << "Error: record range exceeds the number of records (" << fr.n_records() << ")" << endl;
+				return 1;
+			}
+			for(size_t id = first; id <= last; id++) ids.push_back(id);
+		}
+		fr.select(ids);
+	}else if(parse_threads > 0){
+		fr.build_index(parse_threads);
+	}
+	if(shard_n > 0){
+		if(!shard_by_length){
+			fr.set_shard(shard_k, shard_n);
+		}else if(!(fr.has_index() || fr.build_index(max(parse_threads, 1))) || !fr.set_shard_by_length(shard_k, shard_n)){
+			cout << "Error: --shard-by length needs an uncompressed regular input file: " << input_file << endl;
+			return 1;
+		}
+	}
 
-	// check & clear output file
-	ofstream ofs(output_file, ios::out | ios::trunc);
-	if(!ofs){
-		cout << "Error: cannot open output file: " << output_file << endl;
+	// open output file; profiles are written on a background thread
+	ProfileWriter writer;
+	if(shard_n > 0 || resume) writer.set_journal(shard_k, max<size_t>(shard_n, 1));
+	if(resume){
+		// skip the records already in the output, then append
+		const JournalHeader options{format, encoding, shard_k, max<size_t>(shard_n, 1)};
+		vector<JournalEntry> done;
+		if(!find_done_records(output_file, options, done) || !skip_done_records(fr, done)) return 1;
+		if(!writer.resume(output_file, format, precision, encoding, done)) return 1;
+	}else if(!writer.open(output_file, format, precision, encoding)){
 		return 1;
 	}
-	ofs.close();
 
 	// run LinCapR
-	const int s = seq.size();
-	LinCapR lcr(beam_size, energy_model);
-	for(int i = 0; i < s; i++){
-		// calc structural profile
-		lcr.run(seq[i]);
-
-		// output profile
-		ofstream ofs(output_file, ios::out | ios::app);
-		if(!ofs){
-			cout << "Error: cannot open output file: " << output_file << endl;
-			return 1;
-		}
-		lcr.output(ofs, seq_name[i]);
-		ofs.close();
+	BatchRunner runner(threads, fold_threads, beam_size, energy_params, output_energy);
+	runner.set_max_memory(max_memory);
+	runner.set_budget(time_budget, state_budget);
+	runner.set_dedup_memory(dedup_memory);
+	runner.set_window(window, window_overlap);
+	if(!spill_dir.empty() && !runner.set_spill_dir(spill_dir)){
+		cout << "Error: cannot create spill files in: " << spill_dir << endl;
+		return 1;
+	}
+	runner.set_checkpoint_interval(checkpoint_interval);
+	runner.set_energy_only(energy_only);
+	ResultCache cache;
+	if(!cache_dir.empty()){
+		if(!cache.open(cache_dir, cache_size, beam_size, time_budget, state_budget, energy_params, fold_threads > 1)) return 1;
+		runner.set_cache(&cache);
+	}
+	runner.run(fr, writer);
+	if(cache.is_open()) cache.print_stats();
 
-		if(output_energy) printf("G_ensemble: %.2lf\n", lcr.get_energy_ensemble());
+	if(!writer.close()){
+		cout << "Error: cannot write output file: " << output_file << endl;
+		return 1;
+	}
 
-		lcr.clear();
+	if(fr.failed()){
+		cout << "Error: input file is truncated or corrupt: " << input_file << endl;
+		return 1;
 	}
 }
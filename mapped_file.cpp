@@ -0,0 +1,75 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// map file_name read-only
+bool MappedFile::open(const string &file_name){
+	close();
+
+#ifndef _WIN32
+	const int fd = ::open(file_name.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+		::close(fd);
+		return false;
+	}
+
+	len = st.st_size;
+	if(len > 0){
+		void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED){
+			::close(fd);
+			len = 0;
+			return false;
+		}
+		ptr = (const char*)p;
+		mapped = true;
+	}
+	::close(fd);
+#else
+	ifstream ifs(file_name, ios::binary);
+	if(!ifs) return false;
+	buffer.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+	ptr = buffer.data();
+	len = buffer.size();
+#endif
+
+	opened = true;
+	return true;
+}
+
+
+// unmap
+void MappedFile::close(){
+#ifndef _WIN32
+	if(mapped) munmap((void*)ptr, len);
+#endif
+	buffer.clear();
+	buffer.shrink_to_fit();
+	ptr = nullptr;
+	len = 0;
+	opened = false;
+	mapped = false;
+}
+
+
+// ask the kernel to start reading [offset, offset + length) ahead of use
+void MappedFile::prefetch(const size_t offset, const size_t length) const{
+#ifndef _WIN32
+	if(!mapped || offset >= len) return;
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t begin = offset / page * page;
+	const size_t end = min(len, offset + length);
+	madvise((void*)(ptr + begin), end - begin, MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// read-only view of a whole file: mmap on POSIX, a heap copy elsewhere
+class MappedFile{
+public:
+	MappedFile(){}
+	~MappedFile(){ close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile &operator=(const MappedFile&) = delete;
+
+	bool open(const string &file_name);
+	void close();
+
+	bool is_open() const{ return opened; }
+	const char *data() const{ return ptr; }
+	size_t size() const{ return len; }
+
+	// hint that [offset, offset + length) will be read soon
+	void prefetch(const size_t offset, const size_t length) const;
+private:
+	const char *ptr = nullptr;
+	size_t len = 0;
+	bool opened = false;
+	bool mapped = false;
+	vector<char> buffer;
+};
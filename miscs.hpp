@@ -130,8 +130,9 @@ inline Float update_sum(vector<Float> &v, const int i, const Float score){
 
 
 // returns t[i, j] if exists, else default value
-inline Float get_value(Table &t, const int i, const int j, const Float default_value = -INF){
-	return (t[j].count(i) ? t[j][i] : default_value);
+inline Float get_value(const Table &t, const int i, const int j, const Float default_value = -INF){
+	const auto it = t[j].find(i);
+	return (it != t[j].end() ? it->second : default_value);
 }
 
 
@@ -0,0 +1,114 @@
+#include "output_resume.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+// complete record blocks of a text profile file: ">name", one line per
+// context, an empty line; stops at a torn block at the end of the file
+bool scan_text_output(const string &output_file, bool quantized, vector<JournalEntry> &done){
+	MappedFile file;
+	if(!file.open(output_file)){
+		cout << "Error: cannot read output file: " << output_file << endl;
+		return false;
+	}
+	const char *data = file.data();
+	const size_t size = file.size();
+
+	// the next line without its newline; false if it is torn (no newline)
+	size_t pos = 0;
+	auto next_line = [&](string_view &line){
+		const char *end = (pos < size ? (const char*)memchr(data + pos, '\n', size - pos) : nullptr);
+		if(!end) return false;
+		line = string_view(data + pos, end - data - pos);
+		pos = end - data + 1;
+		return true;
+	};
+	auto malformed = [&](){
+		cout << "Error: cannot resume: not a LinCapR text profile file: " << output_file << endl;
+		return false;
+	};
+
+	string_view line;
+	while(next_line(line)){
+		if(line.empty() || line[0] != '>') return malformed();
+		JournalEntry entry{0, done.empty() ? 0 : done.back().end, 0, 0, string(line.substr(1))};
+
+		bool torn = false;
+		for(int k = 0; k < NPROBS; k++){
+			if(!next_line(line)){
+				torn = true;
+				break;
+			}
+			const string label = string(PROFILE_LABELS[k]) + (quantized ? PROFILE_Q8_LABEL_SUFFIX : "") + " ";
+			if(line.compare(0, label.size(), label) != 0) return malformed();
+			// "label v v ... v "
+			if(k == 0) entry.length = count(line.begin(), line.end(), ' ') - 1;
+		}
+		if(torn || !next_line(line)) break;
+		if(!line.empty()) return malformed();
+
+		entry.end = pos;
+		done.push_back(move(entry));
+	}
+	return true;
+}
+
+} // namespace
+
+
+bool find_done_records(const string &output_file, const JournalHeader &options, vector<JournalEntry> &done){
+	done.clear();
+	error_code ec;
+	if(!filesystem::exists(output_file, ec)) return true;
+	const uint64_t size = filesystem::file_size(output_file, ec);
+	if(ec){
+		cout << "Error: cannot read output file: " << output_file << endl;
+		return false;
+	}
+	const bool binary = (options.format == ProfileFormat::Binary);
+
+	const string journal_name = journal_file(output_file);
+	if(!filesystem::exists(journal_name, ec)){
+		if(options.format == ProfileFormat::Text) return scan_text_output(output_file, options.encoding != PROFILE_FLOAT32, done);
+		cout << "Error: cannot resume " << (binary ? "a binary" : "an energy") << " output without its journal: " << journal_name << endl;
+		return false;
+	}
+
+	JournalHeader header;
+	bool complete;
+	if(!RecordJournal::load(journal_name, header, done, complete)) return false;
+	if(header.format != options.format || header.encoding != options.encoding
+		|| header.shard_k != options.shard_k || header.shard_n != options.shard_n){
+		cout << "Error: cannot resume: " << output_file << " was written with another --format, --quantize, --sparse, --energy-only or --shard" << endl;
+		return false;
+	}
+
+	// keep the records whose bytes are all in the file, back to back
+	uint64_t end = (binary ? sizeof(ProfileFileHeader) : 0);
+	size_t n = 0;
+	while(n < done.size() && done[n].offset == end && done[n].end <= size){
+		end = done[n].end;
+		n++;
+	}
+	done.resize(n);
+	return true;
+}
+
+
+bool skip_done_records(FileReader &fr, vector<JournalEntry> &done){
+	string_view name, seq;
+	for(size_t i = 0; i < done.size(); i++){
+		if(!fr.next(name, seq) || name != profile_record_name(done[i].name) || seq.size() != done[i].length){
+			cout << "Error: cannot resume: record " << i + 1 << " of the output (" << done[i].name
+				<< ") is not the next record of the input" << endl;
+			return false;
+		}
+		done[i].number = fr.record_number();
+	}
+	return true;
+}
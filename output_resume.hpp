@@ -0,0 +1,27 @@
+/*
+ * Resuming an interrupted run (--resume).
+ *
+ * The records already in the output file are taken from its record journal
+ * (<output>.idx, see record_journal.hpp), or, for text output written
+ * without one, by scanning the file for complete record blocks. A record
+ * counts as done only if all its bytes are in the file; a torn record at the
+ * end is cut off and folded again. The done records must be the next records
+ * of the input (same names and lengths), which are then skipped.
+ */
+#pragma once
+
+#include "FileReader.hpp"
+#include "record_journal.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// records completely written to output_file by an earlier run with the
+// format, encoding and shard of options (none if the file does not exist)
+bool find_done_records(const string &output_file, const JournalHeader &options, vector<JournalEntry> &done);
+
+// read the done records from fr, checking that they are its next records,
+// and set their input positions
+bool skip_done_records(FileReader &fr, vector<JournalEntry> &done);
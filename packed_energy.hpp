@@ -0,0 +1,87 @@
+/*
+ * Cache-compact copies of the interior-loop energy tables.
+ *
+ * The tables in energy_param.hpp / intloops.hpp are stored as int with the
+ * unused pair types (0: no pair, 7: NN) included, so int22_37 alone is
+ * ~160 KB. energy_loop() only ever sees pair types 1..6, and every finite
+ * Turner energy fits in int16, so the packed copy drops the unused rows and
+ * halves the element size (~57 KB for everything below).
+ */
+#pragma once
+
+#include "energy_model.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace energy {
+
+using Packed = int16_t;
+
+/** Packed stand-in for INF, widened back to INF by unpack() */
+#define PACKED_INF INT16_MAX
+/** The number of pair types stored in packed tables (CG, GC, GU, UG, AU, UA) */
+#define NPACKED_PAIRS 6
+
+// tables read by LinCapR::energy_loop, indexed by (pair type - 1) and laid out
+// in the order energy_loop reads them
+struct PackedLoopTables{
+	Packed stack[NPACKED_PAIRS][NPACKED_PAIRS];
+	Packed bulge[MAXLOOP + 1];
+	Packed internal_loop[MAXLOOP + 1];
+	Packed mismatchI[NPACKED_PAIRS][5][5];
+	Packed mismatch1nI[NPACKED_PAIRS][5][5];
+	Packed mismatch23I[NPACKED_PAIRS][5][5];
+	Packed int11[NPACKED_PAIRS][NPACKED_PAIRS][5][5];
+	Packed int21[NPACKED_PAIRS][NPACKED_PAIRS][5][5][5];
+	Packed int22[NPACKED_PAIRS][NPACKED_PAIRS][5][5][5][5];
+};
+
+// finite energies outside the int16 range (only possible from a --param-file)
+// saturate instead of wrapping around
+inline Packed pack(const int energy){
+	if(energy >= INF) return PACKED_INF;
+	return (Packed)max(min(energy, PACKED_INF - 1), INT16_MIN);
+}
+
+inline int unpack(const Packed energy){
+	return (energy == PACKED_INF ? INF : energy);
+}
+
+inline PackedLoopTables pack_loop_tables(const Params &params){
+	PackedLoopTables t;
+
+	for(int d = 0; d <= MAXLOOP; d++){
+		t.bulge[d] = pack(params.bulge37[d]);
+		t.internal_loop[d] = pack(params.internal_loop37[d]);
+	}
+
+	for(int a = 0; a < NPACKED_PAIRS; a++){
+		for(int x = 0; x < 5; x++){
+			for(int y = 0; y < 5; y++){
+				t.mismatchI[a][x][y] = pack(params.mismatchI37[a + 1][x][y]);
+				t.mismatch1nI[a][x][y] = pack(params.mismatch1nI37[a + 1][x][y]);
+				t.mismatch23I[a][x][y] = pack(params.mismatch23I37[a + 1][x][y]);
+			}
+		}
+
+		for(int b = 0; b < NPACKED_PAIRS; b++){
+			t.stack[a][b] = pack(params.stack37[a + 1][b + 1]);
+
+			for(int x = 0; x < 5; x++){
+				for(int y = 0; y < 5; y++){
+					t.int11[a][b][x][y] = pack((*params.int11_37)[a + 1][b + 1][x][y]);
+					for(int z = 0; z < 5; z++){
+						t.int21[a][b][x][y][z] = pack((*params.int21_37)[a + 1][b + 1][x][y][z]);
+						for(int w = 0; w < 5; w++){
+							t.int22[a][b][x][y][z][w] = pack((*params.int22_37)[a + 1][b + 1][x][y][z][w]);
+						}
+					}
+				}
+			}
+		}
+	}
+	return t;
+}
+
+} // namespace energy
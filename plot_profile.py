@@ -9,6 +9,9 @@ Two common usage modes are supported:
 2. Run LinearCapR from a FASTA file and then plot:
    python plot_profile.py --fasta example.fa --output-prefix example
 
+   With --server SOCKET, the FASTA file is folded by a running
+   `./LinCapR serve SOCKET` instead of a new LinearCapR process.
+
 An optional reference secondary structure in dot-bracket format can be supplied
 to draw a one-line context-label track above the profile plot.
 """
@@ -16,6 +19,7 @@ to draw a one-line context-label track above the profile plot.
 from __future__ import annotations
 
 import argparse
+import socket
 import subprocess
 import tempfile
 from pathlib import Path
@@ -214,15 +218,20 @@ def parse_profile(path: Path) -> tuple[str, dict[str, list[float]]]:
     if not lines or not lines[0].startswith(">"):
         raise ValueError(f"Unexpected profile format: {path}")
 
-    sequence_name = lines[0][1:]
+    # drop the "\tbeam=<n>" annotation of records folded with a downgraded beam
+    sequence_name = lines[0][1:].split("\tbeam=")[0]
     values: dict[str, list[float]] = {}
     label_map = {"Multibranch": "Multiloop"}
     for row in lines[1:]:
         parts = row.split()
         if len(parts) < 2:
             continue
-        context = label_map.get(parts[0], parts[0])
-        values[context] = [float(x) for x in parts[1:]]
+        context, scale = parts[0], 1.0
+        # `--quantize` text output labels its rows "Stem/255" and stores q / 255
+        if context.endswith("/255"):
+            context, scale = context[:-len("/255")], 255.0
+        context = label_map.get(context, context)
+        values[context] = [float(x) / scale for x in parts[1:]]
     return sequence_name, values
 
 
@@ -258,6 +267,23 @@ def run_lincapr(
     subprocess.run(cmd, check=True)
 
 
+def fold_on_server(fasta: Path, output_profile: Path, beam_size: int, socket_path: Path) -> None:
+    """Fold the records of fasta on a LinearCapR server, writing a text profile file."""
+    request = f"FOLD beam={beam_size} format=text\n" + fasta.read_text(encoding="utf-8").rstrip("\n") + "\nEND\n"
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(str(socket_path))
+        sock.sendall(request.encode("utf-8"))
+        stream = sock.makefile("rb")
+        with output_profile.open("wb") as out:
+            while True:
+                header = stream.readline().decode("utf-8")
+                if header.startswith("DONE"):
+                    return
+                if not header.startswith("RECORD"):
+                    raise RuntimeError(f"LinearCapR server error: {header.strip() or 'connection closed'}")
+                out.write(stream.read(int(header.split()[1])))
+
+
 def plot_overlay(
     sequence_name: str,
     values: dict[str, list[float]],
@@ -347,6 +373,12 @@ def parse_args() -> argparse.Namespace:
         default=Path("./LinCapR"),
         help="Path to the LinearCapR executable for --fasta mode",
     )
+    parser.add_argument(
+        "--server",
+        type=Path,
+        default=None,
+        help="Socket of a running `LinCapR serve` to fold --fasta with (energy model set by the server)",
+    )
     parser.add_argument(
         "--reference-secstruct",
         type=Path,
@@ -378,7 +410,10 @@ def main() -> None:
         args.output_prefix.parent.mkdir(parents=True, exist_ok=True)
         with tempfile.TemporaryDirectory(prefix="lincapr-plot-") as tmpdir:
             tmp_profile = Path(tmpdir) / "tmp.profile"
-            run_lincapr(args.fasta, tmp_profile, args.beam_size, args.energy, args.lincapr_bin)
+            if args.server is not None:
+                fold_on_server(args.fasta, tmp_profile, args.beam_size, args.server)
+            else:
+                run_lincapr(args.fasta, tmp_profile, args.beam_size, args.energy, args.lincapr_bin)
             sequence_name, values = parse_profile(tmp_profile)
             reference_labels = None
             if args.reference_secstruct is not None:
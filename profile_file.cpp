@@ -0,0 +1,139 @@
+#include "profile_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+void quantize_q8(const Float p[NPROBS], uint8_t q[NPROBS]){
+	Float sum = 0;
+	for(int k = 0; k < NPROBS; k++) sum += (p[k] > 0 ? p[k] : 0);
+
+	// floor of the scaled values, then the units left go to the largest remainders
+	Float remainder[NPROBS];
+	int left = PROFILE_Q8_SCALE;
+	for(int k = 0; k < NPROBS; k++){
+		const Float x = (sum > 0 && p[k] > 0 ? p[k] / sum * PROFILE_Q8_SCALE : 0);
+		q[k] = min<int>((int)x, PROFILE_Q8_SCALE);
+		remainder[k] = x - q[k];
+		left -= q[k];
+	}
+	if(sum <= 0) return;
+	for(; left > 0; left--){
+		const int k = max_element(remainder, remainder + NPROBS) - remainder;
+		q[k]++;
+		remainder[k] = -1;
+	}
+}
+
+// map file_name and check the header and record table
+bool ProfileFile::open(const string &file_name){
+	close();
+	if(!file.open(file_name)){
+		cout << "Error: cannot open profile file: " << file_name << endl;
+		return false;
+	}
+
+	const size_t size = file.size();
+	header = (const ProfileFileHeader*)file.data();
+	if(size < sizeof(ProfileFileHeader) || memcmp(header->magic, PROFILE_FILE_MAGIC, sizeof(PROFILE_FILE_MAGIC)) != 0){
+		cout << "Error: not a binary profile file: " << file_name << endl;
+		close();
+		return false;
+	}
+	if(header->version != PROFILE_FILE_VERSION || header->encoding > PROFILE_Q8_SPARSE){
+		cout << "Error: unsupported profile file version: " << file_name << endl;
+		close();
+		return false;
+	}
+
+	// smallest size of one position; sparse records are checked by get()
+	const size_t position_bytes = (header->encoding == PROFILE_FLOAT32 ? NPROBS * sizeof(float)
+		: header->encoding == PROFILE_Q8 ? NPROBS : 1);
+	const size_t alignment = (header->encoding == PROFILE_FLOAT32 ? sizeof(float) : 1);
+
+	// file_size is written last, so it also detects interrupted runs
+	bool ok = (header->file_size == size
+		&& header->table_offset % alignof(ProfileRecordEntry) == 0
+		&& header->table_offset <= header->names_offset && header->names_offset <= size
+		&& header->n_records <= (header->names_offset - header->table_offset) / sizeof(ProfileRecordEntry));
+	if(ok){
+		table = (const ProfileRecordEntry*)(file.data() + header->table_offset);
+		names = file.data() + header->names_offset;
+		for(size_t i = 0; i < header->n_records && ok; i++){
+			const ProfileRecordEntry &entry = table[i];
+			ok = (entry.data_offset >= sizeof(ProfileFileHeader) && entry.data_offset <= header->table_offset
+				&& entry.data_offset % alignment == 0
+				&& entry.length <= header->table_offset / position_bytes
+				&& entry.data_offset + position_bytes * entry.length <= header->table_offset
+				&& entry.name_offset <= size - header->names_offset
+				&& entry.name_length <= size - header->names_offset - entry.name_offset);
+		}
+	}
+	if(!ok){
+		cout << "Error: profile file is truncated or corrupt: " << file_name << endl;
+		close();
+		return false;
+	}
+
+	n_records = header->n_records;
+	return true;
+}
+
+
+void ProfileFile::close(){
+	file.close();
+	header = nullptr;
+	table = nullptr;
+	names = nullptr;
+	n_records = 0;
+}
+
+
+string_view ProfileFile::name(const size_t i) const{
+	return string_view(names + table[i].name_offset, table[i].name_length);
+}
+
+
+const float *ProfileFile::values(const size_t i, const int k) const{
+	if(header->encoding != PROFILE_FLOAT32) return nullptr;
+	return (const float*)(file.data() + table[i].data_offset) + k * table[i].length;
+}
+
+
+const uint8_t *ProfileFile::quantized(const size_t i, const int k) const{
+	if(header->encoding != PROFILE_Q8) return nullptr;
+	return (const uint8_t*)(file.data() + table[i].data_offset) + k * table[i].length;
+}
+
+
+bool ProfileFile::get(const size_t i, Profile &profile) const{
+	const size_t length = table[i].length;
+	profile.name = name(i);
+	for(int k = 0; k < NPROBS; k++) profile.probs[k].resize(length);
+
+	if(header->encoding == PROFILE_FLOAT32){
+		for(int k = 0; k < NPROBS; k++) copy(values(i, k), values(i, k) + length, profile.probs[k].begin());
+	}else if(header->encoding == PROFILE_Q8){
+		for(int k = 0; k < NPROBS; k++){
+			const uint8_t *q = quantized(i, k);
+			for(size_t t = 0; t < length; t++) profile.probs[k][t] = (Float)q[t] / PROFILE_Q8_SCALE;
+		}
+	}else{
+		// records are stored back to back, so the next one bounds this one
+		const uint8_t *p = (const uint8_t*)file.data() + table[i].data_offset;
+		const uint8_t *end = (const uint8_t*)file.data() + (i + 1 < n_records ? table[i + 1].data_offset : header->table_offset);
+		for(size_t t = 0; t < length; t++){
+			if(p >= end) return false;
+			const uint8_t mask = *p++;
+			for(int k = 0; k < NPROBS; k++){
+				if(!(mask >> k & 1)){
+					profile.probs[k][t] = 0;
+					continue;
+				}
+				if(p >= end) return false;
+				profile.probs[k][t] = (Float)*p++ / PROFILE_Q8_SCALE;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,135 @@
+/*
+ * Binary profile files (--format binary).
+ *
+ * Layout (little-endian):
+ *   ProfileFileHeader                    64 bytes
+ *   record data                          per record, NPROBS arrays of length
+ *                                        float32 values in PROFILE_LABELS order
+ *   ProfileRecordEntry[n_records]        at table_offset (8-byte aligned)
+ *   names                                at names_offset, not NUL-terminated
+ *
+ * With --quantize the values are stored as uint8 (PROFILE_Q8), q / 255, and
+ * rounded so the six values of every position sum to exactly 255. With
+ * --sparse (PROFILE_Q8_SPARSE) each position is stored as a bit mask of its
+ * non-zero contexts followed by their values.
+ *
+ * The header is written last; an interrupted run leaves file_size = 0.
+ * ProfileFile maps a file and reads the values in place.
+ */
+#pragma once
+
+#include "miscs.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+#define PROFILE_FILE_MAGIC "LCRPROF"
+#define PROFILE_FILE_VERSION 1
+
+// output file format (--format; Energy: --energy-only, a "name\tG_ensemble"
+// line per record)
+enum class ProfileFormat{
+	Text,
+	Binary,
+	Energy,
+};
+
+// value encoding of the record data
+enum ProfileEncoding : uint32_t{
+	// NPROBS float32 arrays
+	PROFILE_FLOAT32 = 0,
+	// NPROBS uint8 arrays
+	PROFILE_Q8 = 1,
+	// per position: uint8 mask (bit k: context k is non-zero), then the non-zero uint8 values
+	PROFILE_Q8_SPARSE = 2,
+};
+
+// scale of the quantized encodings
+#define PROFILE_Q8_SCALE 255
+
+// structural profile of one record
+struct Profile{
+	string name;
+	// position of the record in the input, see FileReader::record_number()
+	uint64_t number = 0;
+	// Bulge, Exterior, Hairpin, Internal, Multiloop, Stem
+	vector<Float> probs[NPROBS];
+	// ensemble free energy and number of bases, for the energy format, whose
+	// profiles have no probabilities
+	Float energy = 0;
+	uint64_t length = 0;
+};
+
+// a record folded with a smaller beam than requested (--time-budget,
+// --state-budget) has the beam appended to its name: "name\tbeam=<n>"
+#define PROFILE_BEAM_TAG "\tbeam="
+
+// record name without the beam annotation
+inline string_view profile_record_name(string_view name){
+	const size_t tag = name.rfind(PROFILE_BEAM_TAG);
+	return (tag == string_view::npos ? name : name.substr(0, tag));
+}
+
+// context labels in output order
+const char *const PROFILE_LABELS[NPROBS] = {"Bulge", "Exterior", "Hairpin", "Internal", "Multiloop", "Stem"};
+
+// quantized text output appends this to each label ("Stem/255 0 0 212 ..."),
+// so readers know to divide the values by PROFILE_Q8_SCALE
+#define PROFILE_Q8_LABEL_SUFFIX "/255"
+
+// round the NPROBS probabilities of one position to q / PROFILE_Q8_SCALE
+// (largest remainder) so that q sums to PROFILE_Q8_SCALE; |q / 255 - p| < 1 / 255
+void quantize_q8(const Float p[NPROBS], uint8_t q[NPROBS]);
+
+struct ProfileFileHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t encoding;
+	uint64_t n_records;
+	uint64_t table_offset;
+	uint64_t names_offset;
+	uint64_t file_size;
+	uint64_t reserved[2];
+};
+static_assert(sizeof(ProfileFileHeader) == 64, "unexpected header padding");
+
+struct ProfileRecordEntry{
+	// record data, see ProfileEncoding
+	uint64_t data_offset;
+	uint64_t length;
+	// relative to names_offset
+	uint64_t name_offset;
+	uint64_t name_length;
+};
+
+class ProfileFile{
+public:
+	ProfileFile(){}
+
+	bool open(const string &file_name);
+	void close();
+
+	size_t size() const{ return n_records; }
+	uint32_t encoding() const{ return header->encoding; }
+	string_view name(const size_t i) const;
+	size_t length(const size_t i) const{ return table[i].length; }
+
+	// values of context k (index into PROFILE_LABELS) of record i, in place
+	// float32 files only
+	const float *values(const size_t i, const int k) const;
+	// PROFILE_Q8 files only
+	const uint8_t *quantized(const size_t i, const int k) const;
+
+	// decode record i of any encoding; returns false if the record is corrupt
+	bool get(const size_t i, Profile &profile) const;
+private:
+	MappedFile file;
+	const ProfileFileHeader *header = nullptr;
+	const ProfileRecordEntry *table = nullptr;
+	const char *names = nullptr;
+	size_t n_records = 0;
+};
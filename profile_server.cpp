@@ -0,0 +1,343 @@
+#include "profile_server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// set by SIGINT / SIGTERM
+volatile sig_atomic_t stop_requested = 0;
+void request_stop(int){ stop_requested = 1; }
+
+// records queued per engine when max_queue is 0
+const size_t QUEUE_PER_ENGINE = 4;
+
+#ifndef _WIN32
+// buffered line reading from a socket
+class LineReader{
+public:
+	explicit LineReader(const int fd) : fd(fd){}
+
+	// next line without its line end; false at the end of the input
+	bool next(string &line){
+		line.clear();
+		while(true){
+			const char *newline = (const char*)memchr(buffer + begin, '\n', end - begin);
+			if(newline){
+				line.append(buffer + begin, newline - buffer - begin);
+				begin = newline - buffer + 1;
+				break;
+			}
+			line.append(buffer + begin, end - begin);
+			begin = end = 0;
+			const ssize_t n = read(fd, buffer, sizeof(buffer));
+			if(n < 0 && errno == EINTR) continue;
+			if(n <= 0){
+				if(line.empty()) return false;
+				break;
+			}
+			end = n;
+		}
+		while(!line.empty() && isspace((unsigned char)line.back())) line.pop_back();
+		return true;
+	}
+private:
+	const int fd;
+	char buffer[1 << 16];
+	size_t begin = 0, end = 0;
+};
+
+// write all of data; false if the client is gone
+bool send_all(const int fd, const char *data, size_t size){
+	while(size > 0){
+		const ssize_t n = write(fd, data, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool send_all(const int fd, const string &s){
+	return send_all(fd, s.data(), s.size());
+}
+#endif
+
+} // namespace
+
+
+ProfileServer::ProfileServer(int threads, int beam_size, const energy::Params &params, int max_clients, size_t max_queue)
+	: beam_size(beam_size), max_clients(max_clients),
+	  max_queue(max_queue > 0 ? max_queue : QUEUE_PER_ENGINE * max(1, threads > 0 ? threads : (int)thread::hardware_concurrency())){
+	if(threads <= 0) threads = max(1u, thread::hardware_concurrency());
+	for(int w = 0; w < threads; w++) engines.push_back(make_unique<LinCapR>(beam_size, params));
+	for(int w = 0; w < threads; w++) workers.emplace_back(&ProfileServer::work, this, w);
+}
+
+
+ProfileServer::~ProfileServer(){
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	not_empty.notify_all();
+	for(thread &worker : workers) worker.join();
+}
+
+
+// queue a record; blocks while the queue is full
+void ProfileServer::submit(Job &&job){
+	unique_lock<mutex> lock(mtx);
+	not_full.wait(lock, [this]{ return jobs.size() < max_queue; });
+	jobs.push_back(move(job));
+	lock.unlock();
+	not_empty.notify_one();
+}
+
+
+// engine w: fold queued records of any request
+void ProfileServer::work(const int w){
+	LinCapR &engine = *engines[w];
+	while(true){
+		unique_lock<mutex> lock(mtx);
+		not_empty.wait(lock, [this]{ return !jobs.empty() || stopping; });
+		if(jobs.empty()) return;
+		Job job = move(jobs.front());
+		jobs.pop_front();
+		lock.unlock();
+		not_full.notify_one();
+
+		Request &request = *job.request;
+		engine.set_beam_size(request.beam_size);
+		engine.run(job.seq);
+		Profile profile;
+		engine.get_profile(profile, job.name);
+		const Float energy = engine.get_energy_ensemble();
+		engine.clear();
+
+		vector<char> data;
+		request.formatter.format_record(profile, data);
+		{
+			lock_guard<mutex> request_lock(request.mtx);
+			Record &record = request.records[job.index];
+			record.data = move(data);
+			record.length = job.seq.size();
+			record.energy = energy;
+			record.ready = true;
+		}
+		request.ready.notify_all();
+	}
+}
+
+
+// "FOLD [beam=<n>] [format=text|binary] [precision=<n>] [quantize] [sparse]"
+bool ProfileServer::parse_request(const string &line, Request &request, string &error) const{
+	stringstream ss(line);
+	string word;
+	ss >> word;
+	if(word != "FOLD"){
+		error = "unknown command: " + word;
+		return false;
+	}
+
+	request.beam_size = beam_size;
+	ProfileFormat format = ProfileFormat::Text;
+	int precision = 6;
+	ProfileEncoding encoding = PROFILE_FLOAT32;
+	while(ss >> word){
+		if(word.compare(0, 5, "beam=") == 0 && isdigit((unsigned char)word[5])){
+			request.beam_size = atoi(word.c_str() + 5);
+		}else if(word == "format=text"){
+			format = ProfileFormat::Text;
+		}else if(word == "format=binary"){
+			format = ProfileFormat::Binary;
+		}else if(word.compare(0, 10, "precision=") == 0 && atoi(word.c_str() + 10) >= 1 && atoi(word.c_str() + 10) <= 17){
+			precision = atoi(word.c_str() + 10);
+		}else if(word == "quantize"){
+			if(encoding == PROFILE_FLOAT32) encoding = PROFILE_Q8;
+		}else if(word == "sparse"){
+			encoding = PROFILE_Q8_SPARSE;
+		}else{
+			error = "invalid option: " + word;
+			return false;
+		}
+	}
+	if(encoding == PROFILE_Q8_SPARSE && format != ProfileFormat::Binary){
+		error = "sparse requires format=binary";
+		return false;
+	}
+	request.formatter = ProfileFormatter(format, precision, encoding);
+	return true;
+}
+
+
+// answer the requests of one connection
+void ProfileServer::serve_client(const int fd){
+#ifndef _WIN32
+	LineReader reader(fd);
+	string line;
+	bool connected = true;
+	while(connected && reader.next(line)){
+		if(line.empty()) continue;
+		if(line == "PING"){
+			connected = send_all(fd, "PONG\n");
+			continue;
+		}
+
+		Request request;
+		string error;
+		if(!parse_request(line, request, error)){
+			send_all(fd, "ERROR " + error + "\n");
+			break;
+		}
+
+		// send the finished records in order; with wait, all submitted ones
+		size_t n_submitted = 0, n_sent = 0;
+		auto send_ready = [&](const bool wait){
+			unique_lock<mutex> lock(request.mtx);
+			while(n_sent < n_submitted){
+				Record &record = request.records[n_sent];
+				if(!record.ready){
+					if(!wait) break;
+					request.ready.wait(lock);
+					continue;
+				}
+				const Record done = move(record);
+				lock.unlock();
+				if(connected){
+					char header[96];
+					snprintf(header, sizeof(header), "RECORD %zu %zu %.2lf\t", done.data.size(), done.length, (double)done.energy);
+					connected = send_all(fd, header + done.name + "\n") && send_all(fd, done.data.data(), done.data.size());
+				}
+				n_sent++;
+				lock.lock();
+			}
+		};
+
+		string name, seq;
+		bool has_record = false, ended = false;
+		auto submit_record = [&](){
+			if(seq.empty()){
+				error = "record has no sequence: " + name;
+				return false;
+			}
+			{
+				lock_guard<mutex> lock(request.mtx);
+				request.records.emplace_back();
+				request.records.back().name = name;
+			}
+			submit({&request, n_submitted++, move(name), move(seq)});
+			name.clear();
+			seq.clear();
+			send_ready(false);
+			return true;
+		};
+
+		// read records, each folded as soon as it is complete
+		while(reader.next(line)){
+			if(line == "END"){
+				ended = (!has_record || submit_record());
+				break;
+			}
+			if(line.empty()) continue;
+			if(line[0] == '>'){
+				if(has_record && !submit_record()) break;
+				name = line.substr(1);
+				has_record = true;
+			}else if(!has_record){
+				error = "sequence before the first '>' line";
+				break;
+			}else{
+				seq += line;
+			}
+		}
+
+		// the jobs point to request: wait for all of them
+		send_ready(true);
+		if(!ended){
+			if(connected) send_all(fd, "ERROR " + (error.empty() ? string("request ended without END") : error) + "\n");
+			break;
+		}
+		if(connected) connected = send_all(fd, "DONE " + to_string(n_sent) + "\n");
+	}
+
+	// close under the lock: once n_clients is 0, run() may return
+	lock_guard<mutex> lock(clients_mtx);
+	client_fds.erase(find(client_fds.begin(), client_fds.end(), fd));
+	close(fd);
+	n_clients--;
+	clients_done.notify_all();
+#endif
+}
+
+
+bool ProfileServer::run(const string &socket_path){
+#ifdef _WIN32
+	cout << "Error: serve needs Unix domain sockets" << endl;
+	return false;
+#else
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if(socket_path.size() >= sizeof(address.sun_path)){
+		cout << "Error: socket path is too long: " << socket_path << endl;
+		return false;
+	}
+	strcpy(address.sun_path, socket_path.c_str());
+
+	// replace a socket left by a server that did not stop cleanly
+	struct stat st;
+	if(lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socket_path.c_str());
+
+	const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listen_fd < 0 || ::bind(listen_fd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0){
+		cout << "Error: cannot listen on socket: " << socket_path << " (" << strerror(errno) << ")" << endl;
+		if(listen_fd >= 0) close(listen_fd);
+		return false;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, request_stop);
+	signal(SIGTERM, request_stop);
+	cout << "Listening on " << socket_path << " with " << engines.size() << " engines" << endl;
+
+	while(!stop_requested){
+		pollfd p{listen_fd, POLLIN, 0};
+		if(poll(&p, 1, 200) <= 0) continue;
+		const int fd = accept(listen_fd, nullptr, nullptr);
+		if(fd < 0) continue;
+
+		lock_guard<mutex> lock(clients_mtx);
+		if(n_clients >= max_clients){
+			send_all(fd, "ERROR server busy\n");
+			close(fd);
+			continue;
+		}
+		n_clients++;
+		client_fds.push_back(fd);
+		thread(&ProfileServer::serve_client, this, fd).detach();
+	}
+
+	close(listen_fd);
+	unlink(socket_path.c_str());
+
+	// end the clients' input, let them finish their requests
+	unique_lock<mutex> lock(clients_mtx);
+	for(const int fd : client_fds) shutdown(fd, SHUT_RD);
+	clients_done.wait(lock, [this]{ return n_clients == 0; });
+	return true;
+#endif
+}
@@ -0,0 +1,96 @@
+/*
+ * Server mode: ./LinCapR serve <socket_path> [options]
+ *
+ * Listens on a Unix domain socket and folds the sequences of each request
+ * on a pool of engines that stay allocated between requests, so a query
+ * pays neither process start nor temporary files. Requests and responses:
+ *
+ *   FOLD [beam=<n>] [format=text|binary] [precision=<n>] [quantize] [sparse]
+ *   >name
+ *   SEQUENCE                  (one or more lines)
+ *   ...
+ *   END
+ *
+ * answered with one frame per record, in request order, each sent as soon as
+ * it and the records before it are folded:
+ *
+ *   RECORD <bytes> <length> <G_ensemble>\t<name>
+ *   <bytes bytes: the text block or binary record data of an output file>
+ *
+ * and DONE <records> at the end (or ERROR <message> for a malformed
+ * request, after which the connection is closed). PING is answered with
+ * PONG. A connection may send any number of requests.
+ *
+ * The records of all connections share one queue of at most max_queue
+ * records; a connection that finds it full stops reading until there is
+ * room. At most max_clients connections are served at once, others are
+ * answered ERROR server busy. The energy model is fixed when the server
+ * starts. SIGINT / SIGTERM stop the server and remove the socket.
+ */
+#pragma once
+
+#include "LinCapR.hpp"
+#include "profile_writer.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ProfileServer{
+public:
+	// threads: engines (0: all cores); beam_size: default of requests
+	ProfileServer(int threads, int beam_size, const energy::Params &params, int max_clients, size_t max_queue);
+	~ProfileServer();
+
+	// serve on socket_path until SIGINT / SIGTERM; false if it cannot listen
+	bool run(const string &socket_path);
+private:
+	struct Record{
+		bool ready = false;
+		vector<char> data;
+		size_t length = 0;
+		Float energy = 0;
+		string name;
+	};
+	// one FOLD request; jobs hold a pointer, so it lives until they are done
+	struct Request{
+		int beam_size;
+		ProfileFormatter formatter;
+		mutex mtx;
+		condition_variable ready;
+		deque<Record> records;
+	};
+	struct Job{
+		Request *request;
+		size_t index;
+		string name, seq;
+	};
+
+	const int beam_size;
+	const int max_clients;
+	const size_t max_queue;
+	vector<unique_ptr<LinCapR>> engines;
+	vector<thread> workers;
+
+	mutex mtx;
+	condition_variable not_empty, not_full;
+	deque<Job> jobs;
+	bool stopping = false;
+
+	// open client connections
+	mutex clients_mtx;
+	condition_variable clients_done;
+	vector<int> client_fds;
+	int n_clients = 0;
+
+	void work(const int w);
+	void submit(Job &&job);
+	void serve_client(const int fd);
+	bool parse_request(const string &line, Request &request, string &error) const;
+};
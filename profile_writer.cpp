@@ -0,0 +1,339 @@
+#include "profile_writer.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+// profiles queued ahead of the writer
+const size_t MAX_PENDING = 4;
+// formatted bytes collected before each fwrite
+const size_t BUFFER_SIZE = 1 << 22;
+// longest %g representation of a double
+const size_t MAX_NUMBER = 32;
+
+} // namespace
+
+
+void ProfileWriter::set_journal(const size_t shard_k, const size_t shard_n){
+	use_journal = true;
+	journal_header.shard_k = shard_k;
+	journal_header.shard_n = shard_n;
+}
+
+
+bool ProfileWriter::open(const string &file_name, ProfileFormat format, int precision, ProfileEncoding encoding){
+	return start(file_name, format, precision, encoding, nullptr);
+}
+
+
+bool ProfileWriter::resume(const string &file_name, ProfileFormat format, int precision, ProfileEncoding encoding,
+                           const vector<JournalEntry> &done){
+	return start(file_name, format, precision, encoding, &done);
+}
+
+
+// open file_name, new or after the records done, and start the writer thread
+bool ProfileWriter::start(const string &file_name, ProfileFormat format, int precision, ProfileEncoding encoding,
+                          const vector<JournalEntry> *done){
+	close();
+	// nothing done: start over
+	if(done && done->empty()) done = nullptr;
+
+	uint64_t end = 0;
+	if(done){
+		end = done->back().end;
+		error_code ec;
+		filesystem::resize_file(file_name, end, ec);
+		fp = (ec ? nullptr : fopen(file_name.c_str(), "r+b"));
+		if(fp && fseek(fp, 0, SEEK_END) != 0){
+			fclose(fp);
+			fp = nullptr;
+		}
+	}else{
+		fp = fopen(file_name.c_str(), format == ProfileFormat::Binary ? "wb" : "w");
+	}
+	if(!fp){
+		cout << "Error: cannot open output file: " << file_name << endl;
+		return false;
+	}
+
+	this->format = format;
+	this->encoding = encoding;
+	formatter = ProfileFormatter(format, precision, encoding);
+	if(!start_journal(file_name, done)){
+		fclose(fp);
+		fp = nullptr;
+		return false;
+	}
+	closing = error = false;
+	buffer.reserve(BUFFER_SIZE);
+	offset = end;
+	entries.clear();
+	names.clear();
+	if(done && format == ProfileFormat::Binary){
+		for(const JournalEntry &entry : *done){
+			entries.push_back({entry.offset, entry.length, names.size(), entry.name.size()});
+			names += entry.name;
+		}
+	}
+
+	// placeholder header, completed by close()
+	if(!done && format == ProfileFormat::Binary){
+		const ProfileFileHeader header{};
+		append(string_view((const char*)&header, sizeof(header)));
+	}
+	writer = thread(&ProfileWriter::run, this);
+	return true;
+}
+
+
+// (re)write the journal of file_name, listing the records done; without a
+// journal, remove one left by an earlier run, which no longer describes the file
+bool ProfileWriter::start_journal(const string &file_name, const vector<JournalEntry> *done){
+	const string journal_name = journal_file(file_name);
+	unjournaled.clear();
+	if(!use_journal){
+		remove(journal_name.c_str());
+		return true;
+	}
+
+	journal_header.format = format;
+	journal_header.encoding = encoding;
+	if(!done) return journal.create(journal_name, journal_header);
+
+	// written aside and renamed, so a crash leaves the old journal or the new one
+	const string temp_name = journal_name + ".tmp";
+	if(!journal.create(temp_name, journal_header)) return false;
+	for(const JournalEntry &entry : *done) journal.add(entry);
+	if(!journal.flush() || rename(temp_name.c_str(), journal_name.c_str()) != 0){
+		cout << "Error: cannot write journal file: " << journal_name << endl;
+		journal.close();
+		return false;
+	}
+	return true;
+}
+
+
+void ProfileWriter::write(Profile &&profile){
+	unique_lock<mutex> lock(mtx);
+	not_full.wait(lock, [this]{ return queue.size() < MAX_PENDING; });
+	queue.push_back(move(profile));
+	lock.unlock();
+	not_empty.notify_one();
+}
+
+
+bool ProfileWriter::close(){
+	if(!fp) return true;
+	{
+		lock_guard<mutex> lock(mtx);
+		closing = true;
+	}
+	not_empty.notify_all();
+	if(writer.joinable()) writer.join();
+
+	if(fclose(fp) != 0) error = true;
+	fp = nullptr;
+	if(journal.is_open()){
+		if(error) journal.close();
+		else if(!journal.finish()) error = true;
+	}
+	return !error;
+}
+
+
+// writer thread: format queued profiles until closed
+void ProfileWriter::run(){
+	while(true){
+		unique_lock<mutex> lock(mtx);
+		not_empty.wait(lock, [this]{ return !queue.empty() || closing; });
+		if(queue.empty()) break;
+		Profile profile = move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+		not_full.notify_one();
+
+		const uint64_t start = offset;
+		if(format == ProfileFormat::Binary){
+			entries.push_back({offset, profile.probs[0].size(), names.size(), profile.name.size()});
+			names += profile.name;
+		}
+		const size_t size = buffer.size();
+		formatter.format_record(profile, buffer);
+		offset += buffer.size() - size;
+		if(buffer.size() >= BUFFER_SIZE) flush_buffer();
+		if(!use_journal) continue;
+
+		const uint64_t length = (format == ProfileFormat::Energy ? profile.length : profile.probs[0].size());
+		unjournaled.push_back({profile.number, start, offset, length, move(profile.name)});
+		// caught up with the folding: journal what is done
+		lock.lock();
+		const bool idle = queue.empty();
+		lock.unlock();
+		if(idle) flush_buffer();
+	}
+	if(format == ProfileFormat::Binary) finish_binary();
+	flush_buffer();
+}
+
+
+ProfileFormatter::ProfileFormatter(ProfileFormat format, int precision, ProfileEncoding encoding)
+	: format(format), precision(precision), encoding(encoding){}
+
+
+void ProfileFormatter::format_record(const Profile &profile, vector<char> &out) const{
+	if(format == ProfileFormat::Binary) format_binary(profile, out);
+	else if(format == ProfileFormat::Energy) format_energy(profile, out);
+	else format_text(profile, out);
+}
+
+
+// ">name", one line per context, then an empty line
+void ProfileFormatter::format_text(const Profile &profile, vector<char> &out) const{
+	auto append = [&](string_view s){ out.insert(out.end(), s.begin(), s.end()); };
+	append(">");
+	append(profile.name);
+	append("\n");
+
+	// quantized values, position by position
+	const size_t length = profile.probs[0].size();
+	vector<uint8_t> q;
+	if(encoding != PROFILE_FLOAT32){
+		q.resize(NPROBS * length);
+		for(size_t i = 0; i < length; i++) quantize(profile, i, &q[NPROBS * i]);
+	}
+
+	for(int k = 0; k < NPROBS; k++){
+		append(PROFILE_LABELS[k]);
+		if(encoding != PROFILE_FLOAT32) append(PROFILE_Q8_LABEL_SUFFIX);
+		append(" ");
+		for(size_t i = 0; i < length; i++){
+			const size_t size = out.size();
+			out.resize(size + MAX_NUMBER);
+			char *first = out.data() + size;
+			char *last;
+			if(encoding != PROFILE_FLOAT32){
+				last = to_chars(first, first + MAX_NUMBER - 1, (int)q[NPROBS * i + k]).ptr;
+			}else{
+#ifdef __cpp_lib_to_chars
+				last = to_chars(first, first + MAX_NUMBER - 1, profile.probs[k][i], chars_format::general, precision).ptr;
+#else
+				last = first + snprintf(first, MAX_NUMBER - 1, "%.*g", precision, (double)profile.probs[k][i]);
+#endif
+			}
+			*last++ = ' ';
+			out.resize(last - out.data());
+		}
+		append("\n");
+	}
+	append("\n");
+}
+
+
+// "name\tG_ensemble", and the beam of a downgraded record in a third column
+void ProfileFormatter::format_energy(const Profile &profile, vector<char> &out) const{
+	const string_view name = profile_record_name(profile.name);
+	char energy[32];
+	const int n = snprintf(energy, sizeof(energy), "\t%.2f", (double)profile.energy);
+	out.insert(out.end(), name.begin(), name.end());
+	out.insert(out.end(), energy, energy + n);
+	out.insert(out.end(), profile.name.begin() + name.size(), profile.name.end());
+	out.push_back('\n');
+}
+
+
+// context arrays in the file encoding, indexed by the record table
+void ProfileFormatter::format_binary(const Profile &profile, vector<char> &out) const{
+	auto append = [&](string_view s){ out.insert(out.end(), s.begin(), s.end()); };
+	const size_t length = profile.probs[0].size();
+
+	if(encoding == PROFILE_FLOAT32){
+		float values[1024];
+		for(int k = 0; k < NPROBS; k++){
+			for(size_t i = 0; i < length; i += 1024){
+				const size_t n = min<size_t>(1024, length - i);
+				for(size_t t = 0; t < n; t++) values[t] = profile.probs[k][i + t];
+				append(string_view((const char*)values, n * sizeof(float)));
+			}
+		}
+	}else if(encoding == PROFILE_Q8){
+		vector<char> values(NPROBS * length);
+		uint8_t q[NPROBS];
+		for(size_t i = 0; i < length; i++){
+			quantize(profile, i, q);
+			for(int k = 0; k < NPROBS; k++) values[k * length + i] = q[k];
+		}
+		append(string_view(values.data(), values.size()));
+	}else{
+		// mask of the non-zero contexts, then their values
+		char values[NPROBS + 1];
+		uint8_t q[NPROBS];
+		for(size_t i = 0; i < length; i++){
+			quantize(profile, i, q);
+			uint8_t mask = 0;
+			int n = 1;
+			for(int k = 0; k < NPROBS; k++){
+				if(q[k] == 0) continue;
+				mask |= 1 << k;
+				values[n++] = q[k];
+			}
+			values[0] = mask;
+			append(string_view(values, n));
+		}
+	}
+}
+
+
+void ProfileFormatter::quantize(const Profile &profile, const size_t i, uint8_t q[NPROBS]) const{
+	Float p[NPROBS];
+	for(int k = 0; k < NPROBS; k++) p[k] = profile.probs[k][i];
+	quantize_q8(p, q);
+}
+
+
+// append the record table and names, then rewrite the header
+void ProfileWriter::finish_binary(){
+	const char padding[8] = {};
+	append(string_view(padding, (8 - offset % 8) % 8));
+
+	ProfileFileHeader header{};
+	memcpy(header.magic, PROFILE_FILE_MAGIC, sizeof(PROFILE_FILE_MAGIC));
+	header.version = PROFILE_FILE_VERSION;
+	header.encoding = encoding;
+	header.n_records = entries.size();
+	header.table_offset = offset;
+	append(string_view((const char*)entries.data(), entries.size() * sizeof(ProfileRecordEntry)));
+	header.names_offset = offset;
+	append(names);
+	header.file_size = offset;
+	flush_buffer();
+
+	if(fseek(fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fp) != 1) error = true;
+}
+
+
+void ProfileWriter::append(string_view s){
+	offset += s.size();
+	buffer.insert(buffer.end(), s.begin(), s.end());
+	if(buffer.size() >= BUFFER_SIZE) flush_buffer();
+}
+
+
+// write the buffer, then journal the records it completed
+void ProfileWriter::flush_buffer(){
+	if(!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()) error = true;
+	buffer.clear();
+
+	if(unjournaled.empty() || error) return;
+	if(fflush(fp) != 0){
+		error = true;
+		return;
+	}
+	for(const JournalEntry &entry : unjournaled) journal.add(entry);
+	if(!journal.flush()) error = true;
+	unjournaled.clear();
+}
@@ -0,0 +1,111 @@
+/*
+ * Structural profile output.
+ *
+ * ProfileFormatter turns a profile into the bytes of its record in an output
+ * file. The output file is opened once. Profiles are queued by the folding thread
+ * and formatted (std::to_chars, or float32 for the binary format, see
+ * profile_file.hpp) and written by a background writer thread into a large
+ * buffer, so formatting and I/O overlap with folding.
+ *
+ * With a journal (set_journal()), each record is listed in <output>.idx once
+ * its bytes have been written to the file (see record_journal.hpp), and the
+ * buffer is also flushed whenever the writer catches up with the folding.
+ */
+#pragma once
+
+#include "miscs.hpp"
+#include "profile_file.hpp"
+#include "record_journal.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ProfileFormatter{
+public:
+	// text values are written with precision significant digits (%g style),
+	// or as integers q (probability q / 255) with encoding PROFILE_Q8
+	ProfileFormatter(ProfileFormat format = ProfileFormat::Text, int precision = 6,
+	                 ProfileEncoding encoding = PROFILE_FLOAT32);
+
+	// append the record to out: a text block, or the binary record data
+	void format_record(const Profile &profile, vector<char> &out) const;
+private:
+	ProfileFormat format;
+	int precision;
+	ProfileEncoding encoding;
+
+	void format_text(const Profile &profile, vector<char> &out) const;
+	void format_binary(const Profile &profile, vector<char> &out) const;
+	void format_energy(const Profile &profile, vector<char> &out) const;
+	void quantize(const Profile &profile, const size_t i, uint8_t q[NPROBS]) const;
+};
+
+class ProfileWriter{
+public:
+	ProfileWriter(){}
+	~ProfileWriter(){ close(); }
+	ProfileWriter(const ProfileWriter&) = delete;
+	ProfileWriter &operator=(const ProfileWriter&) = delete;
+
+	// write the record journal <file_name>.idx for shard k (0-based) of n;
+	// call before open()
+	void set_journal(size_t shard_k, size_t shard_n);
+
+	// truncate file_name and start the writer thread; see ProfileFormatter
+	bool open(const string &file_name, ProfileFormat format = ProfileFormat::Text, int precision = 6,
+	          ProfileEncoding encoding = PROFILE_FLOAT32);
+
+	// continue file_name after the records done (see output_resume.hpp): the
+	// file is cut after the last of them and new profiles are appended
+	bool resume(const string &file_name, ProfileFormat format, int precision, ProfileEncoding encoding,
+	            const vector<JournalEntry> &done);
+
+	// queue a profile; blocks while too many profiles are pending
+	void write(Profile &&profile);
+
+	// write everything queued and close the file; returns false on a write error
+	bool close();
+private:
+	FILE *fp = nullptr;
+	ProfileFormat format = ProfileFormat::Text;
+	ProfileEncoding encoding = PROFILE_FLOAT32;
+	ProfileFormatter formatter;
+	thread writer;
+
+	// profiles waiting to be written
+	mutex mtx;
+	condition_variable not_empty, not_full;
+	deque<Profile> queue;
+	bool closing = false, error = false;
+
+	// formatted output not yet written
+	vector<char> buffer;
+	// bytes passed to append() so far, i.e. the file offset of buffer.end()
+	uint64_t offset = 0;
+
+	bool use_journal = false;
+	JournalHeader journal_header;
+	RecordJournal journal;
+	// records in the buffer, journaled once it is written
+	vector<JournalEntry> unjournaled;
+
+	// binary record table and names, written by close()
+	vector<ProfileRecordEntry> entries;
+	string names;
+
+	bool start(const string &file_name, ProfileFormat format, int precision, ProfileEncoding encoding,
+	           const vector<JournalEntry> *done);
+	bool start_journal(const string &file_name, const vector<JournalEntry> *done);
+	void run();
+	void finish_binary();
+	void append(string_view s);
+	void flush_buffer();
+};
@@ -0,0 +1,103 @@
+#include "record_journal.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char *FORMAT_NAMES[] = {"text", "binary", "energy"};
+
+} // namespace
+
+
+bool RecordJournal::create(const string &file_name, const JournalHeader &header){
+	close();
+	fp = fopen(file_name.c_str(), "w");
+	if(!fp){
+		cout << "Error: cannot open journal file: " << file_name << endl;
+		return false;
+	}
+	error = false;
+	fprintf(fp, "%s %d %s %u %zu/%zu\n", RECORD_JOURNAL_MAGIC, RECORD_JOURNAL_VERSION,
+		FORMAT_NAMES[(int)header.format], (unsigned)header.encoding,
+		header.shard_k + 1, header.shard_n);
+	return flush();
+}
+
+
+bool RecordJournal::add(const JournalEntry &entry){
+	if(fprintf(fp, "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\n",
+		entry.number, entry.offset, entry.end, entry.length, entry.name.c_str()) < 0) error = true;
+	return !error;
+}
+
+
+bool RecordJournal::flush(){
+	if(fflush(fp) != 0) error = true;
+	return !error;
+}
+
+
+bool RecordJournal::finish(){
+	if(!fp) return true;
+	if(!error && fputs("#end\n", fp) < 0) error = true;
+	close();
+	return !error;
+}
+
+
+void RecordJournal::close(){
+	if(!fp) return;
+	if(fclose(fp) != 0) error = true;
+	fp = nullptr;
+}
+
+
+bool RecordJournal::load(const string &file_name, JournalHeader &header, vector<JournalEntry> &entries, bool &complete){
+	entries.clear();
+	complete = false;
+
+	ifstream ifs(file_name);
+	if(!ifs){
+		cout << "Error: cannot open journal file: " << file_name << endl;
+		return false;
+	}
+
+	string line;
+	char format[16];
+	int version = 0;
+	unsigned encoding = 0;
+	size_t k = 0, n = 0;
+	const bool parsed = getline(ifs, line) && sscanf(line.c_str(), RECORD_JOURNAL_MAGIC " %d %15s %u %zu/%zu", &version, format, &encoding, &k, &n) == 5;
+	const auto format_name = find_if(begin(FORMAT_NAMES), end(FORMAT_NAMES), [&](const char *name){ return parsed && strcmp(format, name) == 0; });
+	if(!parsed || version != RECORD_JOURNAL_VERSION || encoding > PROFILE_Q8_SPARSE || k < 1 || k > n || format_name == end(FORMAT_NAMES)){
+		cout << "Error: not a record journal: " << file_name << endl;
+		return false;
+	}
+	header.format = (ProfileFormat)(format_name - begin(FORMAT_NAMES));
+	header.encoding = (ProfileEncoding)encoding;
+	header.shard_k = k - 1;
+	header.shard_n = n;
+
+	// lines are written whole and flushed, so only the last one can be torn:
+	// it lacks the newline getline() would have consumed
+	while(getline(ifs, line) && !ifs.eof()){
+		if(line == "#end"){
+			complete = true;
+			break;
+		}
+		JournalEntry entry;
+		int name_start = -1;
+		if(sscanf(line.c_str(), "%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "\t%n",
+			&entry.number, &entry.offset, &entry.end, &entry.length, &name_start) != 4 || name_start < 0 || entry.end < entry.offset){
+			cout << "Error: record journal is corrupt: " << file_name << endl;
+			return false;
+		}
+		entry.name = line.substr(name_start);
+		entries.push_back(move(entry));
+	}
+	return true;
+}
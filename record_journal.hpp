@@ -0,0 +1,73 @@
+/*
+ * Record journal: <output>.idx, written next to the profile file by sharded
+ * (--shard) and resumable (--resume) runs, and read by the merge subcommand
+ * and by --resume.
+ *
+ * A text file with a header line, one line per record whose bytes have
+ * reached the output file, and an end line once the output is complete:
+ *
+ *   #LCRJOURNAL 1 <text|binary|energy> <encoding> <k>/<n>
+ *   <number>\t<offset>\t<end>\t<length>\t<name>
+ *   ...
+ *   #end
+ *
+ * number is the record's position in the input (records of other shards
+ * counted, see FileReader::record_number), [offset, end) its bytes in the
+ * output file (the record data for the binary format), length its number of
+ * bases. Shard k of n is 1-based; an unsharded run is 1/1.
+ */
+#pragma once
+
+#include "profile_file.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define RECORD_JOURNAL_MAGIC "#LCRJOURNAL"
+#define RECORD_JOURNAL_VERSION 1
+
+struct JournalHeader{
+	ProfileFormat format = ProfileFormat::Text;
+	ProfileEncoding encoding = PROFILE_FLOAT32;
+	// 0-based shard of shard_n
+	size_t shard_k = 0, shard_n = 1;
+};
+
+struct JournalEntry{
+	uint64_t number, offset, end, length;
+	string name;
+};
+
+// journal of output_file
+inline string journal_file(const string &output_file){ return output_file + ".idx"; }
+
+class RecordJournal{
+public:
+	RecordJournal(){}
+	~RecordJournal(){ close(); }
+	RecordJournal(const RecordJournal&) = delete;
+	RecordJournal &operator=(const RecordJournal&) = delete;
+
+	// truncate file_name and write the header line
+	bool create(const string &file_name, const JournalHeader &header);
+	bool is_open() const{ return fp; }
+
+	// append a record line; flush() makes the added lines durable
+	bool add(const JournalEntry &entry);
+	bool flush();
+
+	// write the end line and close
+	bool finish();
+	void close();
+
+	// read a journal; a torn last line (interrupted run) is ignored, complete
+	// tells whether the end line was reached
+	static bool load(const string &file_name, JournalHeader &header, vector<JournalEntry> &entries, bool &complete);
+private:
+	FILE *fp = nullptr;
+	bool error = false;
+};
@@ -0,0 +1,255 @@
+#include "result_cache.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const char ENTRY_MAGIC[8] = {'L', 'C', 'R', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t ENTRY_VERSION = 1;
+const char *ENTRY_EXTENSION = ".lcrc";
+
+struct EntryHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t float_size;
+	uint64_t key[2];
+	uint64_t length;
+	double energy;
+	int32_t beam;
+	uint32_t reserved;
+};
+static_assert(sizeof(EntryHeader) == 56, "unexpected header padding");
+
+// two independent 64-bit hashes (FNV-1a and a multiply-rotate one) of a byte stream
+void hash_bytes(uint64_t h[2], const void *data, const size_t size){
+	const unsigned char *p = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++){
+		h[0] = (h[0] ^ p[i]) * 0x100000001b3ULL;
+		h[1] = h[1] + p[i] * 0x9e3779b97f4a7c15ULL;
+		h[1] = ((h[1] << 27) | (h[1] >> 37)) * 0xc2b2ae3d27d4eb4fULL;
+	}
+}
+
+template<class T> void hash_value(uint64_t h[2], const T &value){
+	hash_bytes(h, &value, sizeof(value));
+}
+
+// optional table: its values, or a marker if the model has none
+template<class T> void hash_table(uint64_t h[2], const T *table, const size_t count){
+	hash_value(h, (bool)table);
+	if(table) hash_bytes(h, table, count * sizeof(T));
+}
+
+// the values of every parameter the engine reads
+void hash_params(uint64_t h[2], const energy::Params &p){
+	hash_value(h, p.temperature);
+	hash_value(h, p.gas_constant);
+	hash_value(h, p.k0);
+	hash_value(h, p.kT);
+	hash_value(h, p.lxc37);
+	hash_value(h, p.ML_intern37);
+	hash_value(h, p.ML_closing37);
+	hash_value(h, p.ML_BASE37);
+	hash_value(h, p.MAX_NINIO);
+	hash_value(h, p.ninio37);
+	hash_value(h, p.TerminalAU37);
+	hash_table(h, p.stack37, NBPAIRS + 1);
+	hash_table(h, p.hairpin37, 31);
+	hash_table(h, p.bulge37, 31);
+	hash_table(h, p.internal_loop37, 31);
+	hash_table(h, p.mismatchI37, NBPAIRS + 1);
+	hash_table(h, p.mismatch1nI37, NBPAIRS + 1);
+	hash_table(h, p.mismatch23I37, NBPAIRS + 1);
+	hash_table(h, p.mismatchH37, NBPAIRS + 1);
+	hash_table(h, p.mismatchM37, NBPAIRS + 1);
+	hash_table(h, p.mismatchExt37, NBPAIRS + 1);
+	hash_table(h, p.dangle5_37, NBPAIRS + 1);
+	hash_table(h, p.dangle3_37, NBPAIRS + 1);
+	hash_table(h, p.int11_37, 1);
+	hash_table(h, p.int21_37, 1);
+	hash_table(h, p.int22_37, 1);
+	hash_table(h, p.Triloops, 241);
+	hash_table(h, p.Triloop37, 40);
+	hash_table(h, p.Tetraloops, 281);
+	hash_table(h, p.Tetraloop37, 40);
+	hash_table(h, p.Hexaloops, 361);
+	hash_table(h, p.Hexaloop37, 40);
+	hash_value(h, p.has_special_hairpins);
+	hash_value(h, p.allow_mismatch_multi);
+	hash_value(h, p.allow_mismatch_external);
+	hash_value(h, p.use_fast_logsumexp);
+}
+
+} // namespace
+
+
+bool ResultCache::open(const string &dir, const size_t max_bytes, const int beam_size, const double time_budget, const size_t state_budget, const energy::Params &params, const bool parallel_fold){
+	error_code ec;
+	filesystem::create_directories(dir, ec);
+	if(!filesystem::is_directory(dir, ec)){
+		cout << "Error: cannot create cache directory: " << dir << endl;
+		return false;
+	}
+	this->dir = dir;
+	this->max_bytes = max_bytes;
+
+	seed[0] = 0xcbf29ce484222325ULL;
+	seed[1] = 0x6a09e667f3bcc909ULL;
+	const int engine = RESULT_CACHE_ENGINE;
+	hash_value(seed, engine);
+	hash_value(seed, beam_size);
+	hash_value(seed, time_budget);
+	hash_value(seed, state_budget);
+	hash_value(seed, parallel_fold);
+	hash_params(seed, params);
+
+	// index the entries of earlier runs, most recently used first
+	vector<pair<filesystem::file_time_type, Entry>> found;
+	for(auto it = filesystem::recursive_directory_iterator(dir, ec); !ec && it != filesystem::recursive_directory_iterator(); it.increment(ec)){
+		if(!it->is_regular_file(ec) || it->path().extension() != ENTRY_EXTENSION) continue;
+		const uint64_t size = it->file_size(ec);
+		const auto mtime = it->last_write_time(ec);
+		if(!ec) found.push_back({mtime, {it->path().string(), size}});
+	}
+	sort(found.begin(), found.end(), [](const auto &a, const auto &b){ return a.first > b.first; });
+	for(auto &[mtime, entry] : found){
+		total_bytes += entry.size;
+		lru.push_back(move(entry));
+		entries[lru.back().file] = prev(lru.end());
+	}
+	lock_guard<mutex> lock(mtx);
+	evict();
+	return true;
+}
+
+
+// file of the entry for seq, and its key
+string ResultCache::entry_file(string_view seq, uint64_t key[2]) const{
+	key[0] = seed[0];
+	key[1] = seed[1];
+	const uint64_t length = seq.size();
+	hash_value(key, length);
+	hash_bytes(key, seq.data(), seq.size());
+
+	char name[40];
+	snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)key[0], (unsigned long long)key[1]);
+	return (filesystem::path(dir) / string(name, 2) / (string(name) + ENTRY_EXTENSION)).string();
+}
+
+
+bool ResultCache::find(string_view seq, Profile &profile, Float &energy, int &beam){
+	uint64_t key[2];
+	const string file = entry_file(seq, key);
+
+	MappedFile mapped;
+	bool hit = mapped.open(file);
+	EntryHeader header;
+	if(hit){
+		hit = mapped.size() >= sizeof(header);
+		if(hit) memcpy(&header, mapped.data(), sizeof(header));
+		hit = hit && memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0 && header.version == ENTRY_VERSION
+			&& header.float_size == sizeof(Float) && header.key[0] == key[0] && header.key[1] == key[1]
+			&& header.length == seq.size() && mapped.size() == sizeof(header) + NPROBS * header.length * sizeof(Float);
+	}
+	if(hit){
+		const Float *values = (const Float*)(mapped.data() + sizeof(header));
+		for(int k = 0; k < NPROBS; k++) profile.probs[k].assign(values + k * header.length, values + (k + 1) * header.length);
+		energy = header.energy;
+		beam = header.beam;
+	}
+	const uint64_t size = mapped.size();
+	mapped.close();
+
+	error_code ec;
+	if(hit) filesystem::last_write_time(file, filesystem::file_time_type::clock::now(), ec);
+
+	lock_guard<mutex> lock(mtx);
+	if(!hit){
+		misses++;
+		return false;
+	}
+	hits++;
+	insert(file, size);
+	return true;
+}
+
+
+void ResultCache::store(string_view seq, const Profile &profile, const Float energy, const int beam){
+	uint64_t key[2];
+	const string file = entry_file(seq, key);
+
+	EntryHeader header{};
+	memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+	header.version = ENTRY_VERSION;
+	header.float_size = sizeof(Float);
+	header.key[0] = key[0];
+	header.key[1] = key[1];
+	header.length = seq.size();
+	header.energy = energy;
+	header.beam = beam;
+
+	// write to a temporary file and rename, so concurrent runs never see a partial entry
+	error_code ec;
+	filesystem::create_directories(filesystem::path(file).parent_path(), ec);
+	const string temp_file = file + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()) ^ chrono::steady_clock::now().time_since_epoch().count());
+	bool ok;
+	{
+		ofstream ofs(temp_file, ios::binary | ios::trunc);
+		ofs.write((const char*)&header, sizeof(header));
+		for(int k = 0; k < NPROBS; k++) ofs.write((const char*)profile.probs[k].data(), profile.probs[k].size() * sizeof(Float));
+		ok = (bool)ofs;
+	}
+	if(ok) filesystem::rename(temp_file, file, ec);
+	if(!ok || ec){
+		filesystem::remove(temp_file, ec);
+		return;
+	}
+
+	lock_guard<mutex> lock(mtx);
+	stores++;
+	insert(file, sizeof(header) + NPROBS * seq.size() * sizeof(Float));
+	evict();
+}
+
+
+// mark file as the most recently used entry; call with mtx held
+void ResultCache::insert(const string &file, const uint64_t size){
+	auto it = entries.find(file);
+	if(it != entries.end()){
+		total_bytes -= it->second->size;
+		lru.erase(it->second);
+	}
+	lru.push_front({file, size});
+	entries[file] = lru.begin();
+	total_bytes += size;
+}
+
+
+// remove least recently used entries down to max_bytes; call with mtx held
+void ResultCache::evict(){
+	while(max_bytes > 0 && total_bytes > max_bytes && !lru.empty()){
+		const Entry &entry = lru.back();
+		error_code ec;
+		filesystem::remove(entry.file, ec);
+		total_bytes -= entry.size;
+		entries.erase(entry.file);
+		lru.pop_back();
+		evictions++;
+	}
+}
+
+
+void ResultCache::print_stats() const{
+	lock_guard<mutex> lock(mtx);
+	fprintf(stderr, "Cache: %zu hits, %zu misses, %zu stored, %zu evicted, %.1f MB in %s\n",
+		hits, misses, stores, evictions, total_bytes / 1048576.0, dir.c_str());
+}
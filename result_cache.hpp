@@ -0,0 +1,75 @@
+/*
+ * Result cache (--cache <dir>): profiles of earlier runs stored on disk by
+ * content, so a sequence folded before with the same settings is not folded
+ * again.
+ *
+ * An entry is keyed by a 128-bit hash of the sequence, the beam size, the
+ * budgets, the energy parameters (their values, so a changed .par file is a
+ * different key), whether the fold runs in parallel (--fold-threads >= 2
+ * sums in another order) and RESULT_CACHE_ENGINE, which is bumped whenever
+ * the engine's results change. It holds the raw profile values and the ensemble
+ * energy, so an output written from the cache is identical to a fresh fold in
+ * every format. Entries are files <dir>/<2 hex>/<32 hex>.lcrc, written to a
+ * temporary name and renamed, so concurrent runs may share a directory.
+ *
+ * The directory is kept under a size limit by removing the least recently
+ * used entries (a hit renews the file's modification time). Lookups and
+ * stores may come from several threads.
+ */
+#pragma once
+
+#include "miscs.hpp"
+#include "energy_model.hpp"
+#include "profile_file.hpp"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+// bump when a change alters folding results
+#define RESULT_CACHE_ENGINE 1
+
+class ResultCache{
+public:
+	ResultCache(){}
+	ResultCache(const ResultCache&) = delete;
+	ResultCache &operator=(const ResultCache&) = delete;
+
+	// use (and create) dir for results of the given settings; max_bytes 0: no limit
+	bool open(const string &dir, size_t max_bytes, int beam_size, double time_budget, size_t state_budget, const energy::Params &params, bool parallel_fold);
+	bool is_open() const{ return !dir.empty(); }
+
+	// on a hit, fill profile.probs, energy and the beam the profile was folded
+	// with (it differs from the requested one after a budget downgrade)
+	bool find(string_view seq, Profile &profile, Float &energy, int &beam);
+	void store(string_view seq, const Profile &profile, Float energy, int beam);
+
+	// "Cache: <hits> hits, <misses> misses, ..." on stderr
+	void print_stats() const;
+private:
+	struct Entry{
+		string file;
+		uint64_t size;
+	};
+
+	string dir;
+	size_t max_bytes = 0;
+	// hash state after the settings, continued with the sequence
+	uint64_t seed[2];
+
+	mutable mutex mtx;
+	// most recently used first
+	list<Entry> lru;
+	unordered_map<string, list<Entry>::iterator> entries;
+	uint64_t total_bytes = 0;
+	size_t hits = 0, misses = 0, stores = 0, evictions = 0;
+
+	string entry_file(string_view seq, uint64_t key[2]) const;
+	void insert(const string &file, uint64_t size);
+	void evict();
+};
@@ -0,0 +1,141 @@
+#include "shard_merge.hpp"
+#include "mapped_file.hpp"
+#include "profile_file.hpp"
+#include "record_journal.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace {
+
+struct Shard{
+	string file_name;
+	MappedFile file;
+	JournalHeader header;
+	vector<JournalEntry> entries;
+};
+
+// record entry of shard
+struct Source{
+	uint64_t number;
+	size_t shard, entry;
+};
+
+} // namespace
+
+
+bool merge_shards(const string &output_file, const vector<string> &shard_files){
+	// load the journals and map the shard outputs
+	vector<unique_ptr<Shard>> shards;
+	for(const string &file_name : shard_files){
+		auto shard = make_unique<Shard>();
+		shard->file_name = file_name;
+		bool complete;
+		if(!RecordJournal::load(journal_file(file_name), shard->header, shard->entries, complete)) return false;
+		if(!complete){
+			cout << "Error: shard output is incomplete (interrupted run?): " << file_name << endl;
+			return false;
+		}
+		if(!shard->file.open(file_name)){
+			cout << "Error: cannot open shard output: " << file_name << endl;
+			return false;
+		}
+		for(const JournalEntry &entry : shard->entries){
+			if(entry.end > shard->file.size()){
+				cout << "Error: shard output is truncated: " << file_name << endl;
+				return false;
+			}
+		}
+
+		const JournalHeader &first = (shards.empty() ? shard->header : shards[0]->header);
+		if(shard->header.format != first.format || shard->header.encoding != first.encoding || shard->header.shard_n != first.shard_n){
+			cout << "Error: shard outputs have different formats or shard counts: " << file_name << endl;
+			return false;
+		}
+		shards.push_back(move(shard));
+	}
+	if(shards.empty()) return false;
+
+	// every shard exactly once
+	const JournalHeader &header = shards[0]->header;
+	vector<bool> seen(header.shard_n);
+	for(const auto &shard : shards){
+		if(seen[shard->header.shard_k]){
+			cout << "Error: shard " << shard->header.shard_k + 1 << "/" << header.shard_n << " is given twice: " << shard->file_name << endl;
+			return false;
+		}
+		seen[shard->header.shard_k] = true;
+	}
+	if(shards.size() != header.shard_n){
+		cout << "Error: " << header.shard_n << " shard outputs are needed, " << shards.size() << " given" << endl;
+		return false;
+	}
+
+	// input order; the shards together must cover records 0, 1, 2, ...
+	vector<Source> sources;
+	for(size_t s = 0; s < shards.size(); s++){
+		for(size_t e = 0; e < shards[s]->entries.size(); e++) sources.push_back({shards[s]->entries[e].number, s, e});
+	}
+	sort(sources.begin(), sources.end(), [](const Source &a, const Source &b){ return a.number < b.number; });
+	for(size_t i = 0; i < sources.size(); i++){
+		if(sources[i].number != i){
+			cout << "Error: record " << (sources[i].number < i ? sources[i].number : i) + 1
+				<< (sources[i].number < i ? " is in two shard outputs" : " is missing from the shard outputs") << endl;
+			return false;
+		}
+	}
+
+	const bool binary = (header.format == ProfileFormat::Binary);
+	FILE *fp = fopen(output_file.c_str(), binary ? "wb" : "w");
+	if(!fp){
+		cout << "Error: cannot open output file: " << output_file << endl;
+		return false;
+	}
+	remove(journal_file(output_file).c_str());
+
+	bool error = false;
+	uint64_t offset = 0;
+	auto put = [&](const void *data, const size_t size){
+		if(size > 0 && fwrite(data, 1, size, fp) != size) error = true;
+		offset += size;
+	};
+
+	// binary: placeholder header, record data, then the table and names as
+	// written by ProfileWriter
+	ProfileFileHeader file_header{};
+	vector<ProfileRecordEntry> table;
+	string names;
+	if(binary) put(&file_header, sizeof(file_header));
+
+	for(const Source &source : sources){
+		const Shard &shard = *shards[source.shard];
+		const JournalEntry &entry = shard.entries[source.entry];
+		if(binary){
+			table.push_back({offset, entry.length, names.size(), entry.name.size()});
+			names += entry.name;
+		}
+		put(shard.file.data() + entry.offset, entry.end - entry.offset);
+	}
+
+	if(binary){
+		const char padding[8] = {};
+		put(padding, (8 - offset % 8) % 8);
+		memcpy(file_header.magic, PROFILE_FILE_MAGIC, sizeof(PROFILE_FILE_MAGIC));
+		file_header.version = PROFILE_FILE_VERSION;
+		file_header.encoding = header.encoding;
+		file_header.n_records = table.size();
+		file_header.table_offset = offset;
+		put(table.data(), table.size() * sizeof(ProfileRecordEntry));
+		file_header.names_offset = offset;
+		put(names.data(), names.size());
+		file_header.file_size = offset;
+		if(fseek(fp, 0, SEEK_SET) != 0 || fwrite(&file_header, sizeof(file_header), 1, fp) != 1) error = true;
+	}
+
+	if(fclose(fp) != 0) error = true;
+	if(error) cout << "Error: cannot write output file: " << output_file << endl;
+	return !error;
+}
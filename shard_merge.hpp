@@ -0,0 +1,17 @@
+/*
+ * Merging the outputs of a sharded run (--shard k/n) into one profile file.
+ *
+ * Every shard output must come with its complete record journal
+ * (<output>.idx). The records are copied byte for byte, in input order, from
+ * the shard files; profiles are not parsed or reformatted, so the result is
+ * identical to the output of an unsharded run.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// merge shard_files (all n shards of one run, in any order) into output_file
+bool merge_shards(const string &output_file, const vector<string> &shard_files);
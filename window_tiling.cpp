@@ -0,0 +1,51 @@
+#include "window_tiling.hpp"
+
+#include <algorithm>
+
+WindowTiling::WindowTiling(const size_t length, const size_t window, const size_t overlap)
+	: length(length), window(window), overlap(overlap), step(window - overlap),
+	  count((length - overlap + step - 1) / step){
+	for(int i = 0; i < NPROBS; i++) probs[i].assign(length, 0);
+}
+
+
+// weight of window k at position pos of the record (see window_tiling.hpp)
+Float WindowTiling::weight(const size_t k, const size_t pos) const{
+	// margin of the overlap taken from the other window, and the crossfade
+	const size_t margin = overlap / 4, ramp = overlap - 2 * margin;
+	auto fade_in = [&](const size_t begin){ return (pos - begin + Float(0.5)) / ramp; };
+
+	const size_t start = window_start(k), end = window_end(k);
+	if(k > 0){
+		if(pos < start + margin) return 0;
+		if(pos < start + overlap - margin) return fade_in(start + margin);
+	}
+	if(k + 1 < count){
+		if(pos >= end - margin) return 0;
+		if(pos >= end - overlap + margin) return 1 - fade_in(end - overlap + margin);
+	}
+	return 1;
+}
+
+
+bool WindowTiling::add(const size_t k, const Profile &profile){
+	const size_t start = window_start(k), end = window_end(k);
+	vector<Float> weights(end - start);
+	for(size_t pos = start; pos < end; pos++) weights[pos - start] = weight(k, pos);
+
+	// at most two windows add to a position, onto 0: the sum is the same in
+	// either order
+	lock_guard<mutex> lock(mtx);
+	for(int i = 0; i < NPROBS; i++){
+		for(size_t pos = start; pos < end; pos++){
+			if(weights[pos - start] > 0) probs[i][pos] += weights[pos - start] * profile.probs[i][pos - start];
+		}
+	}
+	return ++n_added == count;
+}
+
+
+void WindowTiling::take(Profile &profile){
+	lock_guard<mutex> lock(mtx);
+	for(int i = 0; i < NPROBS; i++) profile.probs[i] = move(probs[i]);
+}
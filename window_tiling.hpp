@@ -0,0 +1,51 @@
+/*
+ * Sliding-window tiling of long records (--window, --window-overlap).
+ *
+ * A record longer than the window is folded as overlapping windows of at
+ * most window bases, starting every window - overlap bases; the last one is
+ * cut at the end of the record. The DP tables then only grow with the window
+ * size, and the windows of a record may be folded in parallel. The stitched
+ * profile (NPROBS values per base) is still built in memory.
+ *
+ * Values near a window end, where pairs with bases beyond it are missing,
+ * are not used: in the overlap of two windows, the outer quarter on each
+ * side is taken from the window that reaches further past it, and the middle
+ * half is a linear crossfade from the left window to the right one. Every
+ * position gets values from at most two windows, with weights summing to 1,
+ * so the result does not depend on the order the windows finish in.
+ */
+#pragma once
+
+#include "miscs.hpp"
+#include "profile_file.hpp"
+
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+class WindowTiling{
+public:
+	// requires overlap <= window / 2 and length > window
+	WindowTiling(size_t length, size_t window, size_t overlap);
+
+	size_t n_windows() const{ return count; }
+	// bases [window_start(k), window_end(k)) of the record
+	size_t window_start(const size_t k) const{ return k * step; }
+	size_t window_end(const size_t k) const{ return min(length, k * step + window); }
+
+	// add the profile of window k; true if it was the last missing window.
+	// May be called from several threads
+	bool add(size_t k, const Profile &profile);
+
+	// the stitched profile (probabilities only), after all windows were added
+	void take(Profile &profile);
+private:
+	const size_t length, window, overlap, step, count;
+	mutex mtx;
+	size_t n_added = 0;
+	vector<Float> probs[NPROBS];
+
+	Float weight(size_t k, size_t pos) const;
+};